@@ -0,0 +1,124 @@
+
+#include "../tests/testhost.h"
+#include "../include/parameters.h"
+#include "../include/plugids.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace Benergy::BadTempered;
+
+// Cache misses of process with up to all voices playing, from the hardware counters of
+// perf_event_open, so Linux only. The counters may need perf_event_paranoid at 2 or lower,
+// without them only the time is shown.
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const int32 kBlockSize = 256;
+const int kNumWarmUpBlocks = 50;
+const int kNumBlocks = 500;
+
+class PerfCounter
+{
+public:
+	PerfCounter(uint32 type, uint64 config)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	~PerfCounter()
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool isOpen() const { return fd >= 0; }
+
+	void start()
+	{
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	uint64 stop()
+	{
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		uint64 value = 0;
+		return read(fd, &value, sizeof(value)) == sizeof(value) ? value : 0;
+	}
+
+private:
+	int fd;
+};
+
+const uint64 kL1DataReadMisses = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+}
+
+int main()
+{
+	printf("%8s %14s %18s %18s %18s\n", "voices", "us per block", "cache references", "cache misses", "L1 data misses");
+
+	for (int16 numVoices : {16, 32, MAX_VOICES})
+	{
+		TestHost host(kSampleRate, Vst::kOffline);
+		host.parameterChanges.add(kVolumeId, 0, ParameterTable::find(kVolumeId)->toNormalized(-24.0));
+		host.parameterChanges.add(kSustainId, 0, 1.0);
+		host.parameterChanges.add(kUnisonVoicesId, 0, 1.0);
+		host.parameterChanges.add(kFilterCutoffId, 0, 0.5);
+		host.parameterChanges.add(kFilterEnvelopeId, 0, 0.75);
+		for (int16 i = 0; i < numVoices; ++i)
+			host.events.add(TestHost::makeNoteOn(0, (int16)(30 + i), 0.8f, (int16)(i % MAX_PARTS)));
+		for (int block = 0; block < kNumWarmUpBlocks; ++block)
+			host.process(kBlockSize);
+
+		// Counting only this thread, and only between start and stop around process
+		PerfCounter references(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
+		PerfCounter misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		PerfCounter l1Misses(PERF_TYPE_HW_CACHE, kL1DataReadMisses);
+		PerfCounter* counters[] = { &references, &misses, &l1Misses };
+
+		double counts[3] = {};
+		double seconds = 0;
+		for (int block = 0; block < kNumBlocks; ++block)
+		{
+			for (PerfCounter* counter : counters)
+			{
+				if (counter->isOpen())
+					counter->start();
+			}
+			const auto start = std::chrono::steady_clock::now();
+			host.process(kBlockSize);
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			for (int c = 0; c < 3; ++c)
+			{
+				if (counters[c]->isOpen())
+					counts[c] += (double)counters[c]->stop();
+			}
+		}
+
+		printf("%8d %14.1f", numVoices, 1e6 * seconds / kNumBlocks);
+		for (int c = 0; c < 3; ++c)
+		{
+			if (counters[c]->isOpen())
+				printf(" %18.0f", counts[c] / kNumBlocks);
+			else
+				printf(" %18s", "n/a");
+		}
+		printf("\n");
+	}
+	return 0;
+}
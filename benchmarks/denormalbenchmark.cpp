@@ -0,0 +1,84 @@
+
+#include "../tests/testhost.h"
+#include "../include/denormals.h"
+#include "../include/parameters.h"
+#include "../include/plugids.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace Benergy::BadTempered;
+
+// CPU time over a 10 s release tail of all voices, in slices of a second. Built twice, once
+// with flush to zero in process and once without, the times should stay flat in both.
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const int32 kBlockSize = 512;
+const int kNumSlices = 12; // the release and the silence after it
+const int kNumRuns = 5;
+
+// Seconds of processing per slice of one run
+std::vector<double> renderTail(int& numDenormals)
+{
+	TestHost host(kSampleRate);
+	host.parameterChanges.add(kAttackId, 0, ParameterTable::find(kAttackId)->toNormalized(3.0));
+	host.parameterChanges.add(kSustainId, 0, 1.0);
+	host.parameterChanges.add(kReleaseId, 0, ParameterTable::find(kReleaseId)->toNormalized(10000.0));
+	for (int16 i = 0; i < MAX_VOICES; ++i)
+		host.events.add(TestHost::makeNoteOn(0, (int16)(36 + i)));
+
+	const int32 blocksPerSecond = (int32)(kSampleRate / kBlockSize);
+	for (int32 block = 0; block < blocksPerSecond / 2; ++block)
+		host.process(kBlockSize);
+
+	for (int16 i = 0; i < MAX_VOICES; ++i)
+		host.events.add(TestHost::makeNoteOff(0, (int16)(36 + i)));
+
+	std::vector<double> slices;
+	for (int slice = 0; slice < kNumSlices; ++slice)
+	{
+		double seconds = 0;
+		for (int32 block = 0; block < blocksPerSecond; ++block)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			host.process(kBlockSize);
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			for (int32 channel = 0; channel < 2; ++channel)
+			{
+				const float* output = host.getOutput(channel);
+				for (int32 i = 0; i < kBlockSize; ++i)
+					numDenormals += std::fpclassify(output[i]) == FP_SUBNORMAL;
+			}
+		}
+		slices.push_back(seconds);
+	}
+	return slices;
+}
+
+}
+
+int main()
+{
+	printf("flush to zero in process: %s\n", BADTEMPERED_FLUSH_DENORMALS ? "on" : "off");
+
+	std::vector<double> best(kNumSlices, 1e30);
+	int numDenormals = 0;
+	for (int run = 0; run < kNumRuns; ++run)
+	{
+		const std::vector<double> slices = renderTail(numDenormals);
+		for (int slice = 0; slice < kNumSlices; ++slice)
+			best[slice] = std::min(best[slice], slices[slice]);
+	}
+
+	printf("%10s %14s %14s\n", "second", "cpu in ms", "of the first");
+	for (int slice = 0; slice < kNumSlices; ++slice)
+		printf("%10d %14.2f %13.0f %%\n", slice, 1000.0 * best[slice], 100.0 * best[slice] / best[0]);
+	printf("denormal output samples %d\n", numDenormals);
+	return 0;
+}
@@ -0,0 +1,189 @@
+
+#include "pluginterfaces/base/ipluginbase.h"
+#include "pluginterfaces/vst/ivstaudioprocessor.h"
+#include "pluginterfaces/vst/ivstcomponent.h"
+
+#if SMTG_OS_WINDOWS
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace Steinberg;
+
+// Time from loading the module until a processor can process, like a host scanning and
+// then instantiating the plug-in. Loading runs the static initialisers of the module, so
+// anything computed there shows up in the first line. Each instance is then created through
+// the factory and goes through initialize, setupProcessing and setActive. The first instance
+// at a sample rate builds the shared tables, the following ones reuse them while it is alive.
+//
+// A module is only loaded once per process, run the benchmark a few times to compare loads.
+// Run with the path of the module binary, by default the one built with the benchmark.
+
+namespace {
+
+const int kNumInstances = 32;
+
+using Clock = std::chrono::steady_clock;
+
+double microsecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+#if SMTG_OS_WINDOWS
+void* openModule(const char* path) { return LoadLibraryA(path); }
+void* findSymbol(void* module, const char* name) { return (void*)GetProcAddress((HMODULE)module, name); }
+void closeModule(void* module) { FreeLibrary((HMODULE)module); }
+#else
+void* openModule(const char* path) { return dlopen(path, RTLD_LAZY | RTLD_LOCAL); }
+void* findSymbol(void* module, const char* name) { return dlsym(module, name); }
+void closeModule(void* module) { dlclose(module); }
+#endif
+
+// What a host calls after loading and before unloading the module, on macOS without a bundle
+bool enterModule(void* module)
+{
+#if SMTG_OS_WINDOWS
+	auto initDll = (bool (*)())findSymbol(module, "InitDll");
+	return !initDll || initDll();
+#elif SMTG_OS_MACOS
+	auto bundleEntry = (bool (*)(void*))findSymbol(module, "bundleEntry");
+	return bundleEntry && bundleEntry(nullptr);
+#else
+	auto moduleEntry = (bool (*)(void*))findSymbol(module, "ModuleEntry");
+	return moduleEntry && moduleEntry(module);
+#endif
+}
+
+void exitModule(void* module)
+{
+#if SMTG_OS_WINDOWS
+	if (auto exitDll = (bool (*)())findSymbol(module, "ExitDll"))
+		exitDll();
+#elif SMTG_OS_MACOS
+	if (auto bundleExit = (bool (*)())findSymbol(module, "bundleExit"))
+		bundleExit();
+#else
+	if (auto moduleExit = (bool (*)())findSymbol(module, "ModuleExit"))
+		moduleExit();
+#endif
+}
+
+class Instance
+{
+public:
+	// Returns the time until the processor is active in us, or a negative time on failure
+	double start(IPluginFactory* factory, const TUID processorClass, double sampleRate)
+	{
+		const auto startTime = Clock::now();
+		if (factory->createInstance(processorClass, Vst::IComponent::iid, (void**)&component) != kResultOk || !component)
+			return -1.0;
+		FUnknownPtr<Vst::IAudioProcessor> processor(component);
+		if (!processor || component->initialize(nullptr) != kResultOk)
+			return -1.0;
+		initialized = true;
+
+		Vst::ProcessSetup setup = { Vst::kRealtime, Vst::kSample32, 512, sampleRate };
+		if (processor->setupProcessing(setup) != kResultOk || component->setActive(true) != kResultOk)
+			return -1.0;
+		active = true;
+		return microsecondsSince(startTime);
+	}
+
+	~Instance()
+	{
+		if (active)
+			component->setActive(false);
+		if (initialized)
+			component->terminate();
+		if (component)
+			component->release();
+	}
+
+private:
+	Vst::IComponent* component = nullptr;
+	bool initialized = false;
+	bool active = false;
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = argc > 1 ? argv[1] : BADTEMPERED_MODULE_PATH;
+
+	auto startTime = Clock::now();
+	void* module = openModule(path);
+	const double loadTime = microsecondsSince(startTime);
+	if (!module)
+	{
+		printf("%s can't be loaded\n", path);
+		return 1;
+	}
+
+	startTime = Clock::now();
+	const bool entered = enterModule(module);
+	const double entryTime = microsecondsSince(startTime);
+
+	startTime = Clock::now();
+	auto getPluginFactory = (GetFactoryProc)findSymbol(module, "GetPluginFactory");
+	IPluginFactory* factory = entered && getPluginFactory ? getPluginFactory() : nullptr;
+	const double factoryTime = microsecondsSince(startTime);
+
+	PClassInfo processorClass = {};
+	for (int32 i = 0; factory && i < factory->countClasses(); ++i)
+	{
+		PClassInfo info;
+		if (factory->getClassInfo(i, &info) == kResultOk && strcmp(info.category, kVstAudioEffectClass) == 0)
+			processorClass = info;
+	}
+	if (!factory || processorClass.category[0] == '\0')
+	{
+		printf("%s has no processor\n", path);
+		return 1;
+	}
+
+	printf("%-32s %10.1f us\n", "loading the module", loadTime);
+	printf("%-32s %10.1f us\n", "module entry", entryTime);
+	printf("%-32s %10.1f us\n\n", "GetPluginFactory", factoryTime);
+
+	printf("%12s %14s %16s %16s\n", "sample rate", "first in us", "median in us", "max in us");
+
+	bool failed = false;
+	for (double sampleRate : {44100.0, 48000.0, 88200.0, 96000.0, 192000.0})
+	{
+		Instance first;
+		const double firstTime = first.start(factory, processorClass.cid, sampleRate);
+
+		std::vector<std::unique_ptr<Instance>> others;
+		std::vector<double> times;
+		for (int i = 0; i < kNumInstances; ++i)
+		{
+			others.emplace_back(new Instance());
+			times.push_back(others.back()->start(factory, processorClass.cid, sampleRate));
+		}
+		std::sort(times.begin(), times.end());
+
+		failed |= firstTime < 0.0 || times.front() < 0.0;
+		printf("%12.0f %14.1f %16.1f %16.1f\n", sampleRate, firstTime, times[times.size() / 2], times.back());
+	}
+
+	factory->release();
+	exitModule(module);
+	closeModule(module);
+
+	if (failed)
+	{
+		printf("creating a processor FAILED\n");
+		return 1;
+	}
+	return 0;
+}
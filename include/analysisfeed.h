@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../include/triplebuffer.h"
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// What the editor shows of the processor's output, see AnalysisFeed
+struct AnalysisFrame
+{
+	static constexpr int32 kNumSamples = 1024;
+	static constexpr int32 kMaxNotes = 64;
+
+	struct Note
+	{
+		int32 pitch;
+		float frequency; // in Hz, with tuning and note expressions
+	};
+
+	float samples[kNumSamples]; // mono, decimated to sampleRate
+	double sampleRate;
+	int32 numNotes;
+	Note notes[kMaxNotes];
+};
+
+// Feed of the processor's output for the editor's meters. The audio thread only decimates and
+// copies, everything else (FFT, drawing) is left to the UI thread reading the frames.
+class AnalysisFeed
+{
+public:
+	// Not on the audio thread, the rate of the frames is kept near kTargetRate
+	void setSampleRate(double sampleRate)
+	{
+		decimation = std::max(int32(1), (int32)(sampleRate / kTargetRate));
+		frameSampleRate = sampleRate / decimation;
+		position = 0;
+		sum = 0.f;
+		sumCount = 0;
+	}
+
+	// Audio thread. NoteSource provides getSoundingNotes(notes, maxNotes), sampled when a frame
+	// is published.
+	template <class NoteSource>
+	void write(const float* left, const float* right, int32 numSamples, const NoteSource& notes)
+	{
+		for (int32 i = 0; i < numSamples; ++i)
+		{
+			// Averaging is enough of a low pass for display
+			sum += left[i] + right[i];
+			if (++sumCount < decimation)
+				continue;
+
+			AnalysisFrame& frame = frames.getWriteBuffer();
+			frame.samples[position++] = sum / (2 * decimation);
+			sum = 0.f;
+			sumCount = 0;
+
+			if (position == AnalysisFrame::kNumSamples)
+			{
+				frame.sampleRate = frameSampleRate;
+				frame.numNotes = notes.getSoundingNotes(frame.notes, AnalysisFrame::kMaxNotes);
+				frames.publish();
+				position = 0;
+			}
+		}
+	}
+
+	// UI thread, copies the latest frame if there is a new one
+	bool read(AnalysisFrame& frame)
+	{
+		if (!frames.update())
+			return false;
+		frame = frames.getReadBuffer();
+		return true;
+	}
+
+	// The processor hands its feed to the controller by an id, which only works within one
+	// process. The registry only holds weak references, so a lost or rejected message leaks
+	// nothing. findFeed returns nullptr for unknown ids and feeds gone already.
+	static int64 getProcessId();
+	static int64 registerFeed(const std::shared_ptr<AnalysisFeed>& feed);
+	static std::shared_ptr<AnalysisFeed> findFeed(int64 id);
+
+private:
+	static constexpr double kTargetRate = 20000.0;
+
+	TripleBuffer<AnalysisFrame> frames;
+	int32 decimation = 1;
+	double frameSampleRate = 44100.0;
+	int32 position = 0;
+	float sum = 0.f;
+	int32 sumCount = 0;
+};
+
+}
+}
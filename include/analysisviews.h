@@ -0,0 +1,59 @@
+#pragma once
+
+#include "../include/analysisfeed.h"
+
+#include "vstgui/lib/cview.h"
+
+namespace Benergy {
+namespace BadTempered {
+
+// Editor views of the processor's output, they run entirely on the UI thread. The controller
+// reads the AnalysisFeed and calls frameChanged on all of them when a new frame arrived.
+class AnalysisView : public VSTGUI::CView
+{
+public:
+	AnalysisView(const VSTGUI::CRect& size, const AnalysisFrame& frame) : CView(size), frame(frame) {}
+
+	virtual void frameChanged() { invalid(); }
+
+protected:
+	void drawBackground(VSTGUI::CDrawContext* context);
+
+	const AnalysisFrame& frame;
+};
+
+// Output waveform, triggered on a rising zero crossing so periodic sounds stand still
+class OscilloscopeView : public AnalysisView
+{
+public:
+	using AnalysisView::AnalysisView;
+
+	void draw(VSTGUI::CDrawContext* context) SMTG_OVERRIDE;
+};
+
+// Level over a logarithmic frequency axis, from an FFT of the frame
+class SpectrumView : public AnalysisView
+{
+public:
+	SpectrumView(const VSTGUI::CRect& size, const AnalysisFrame& frame);
+
+	void frameChanged() SMTG_OVERRIDE;
+	void draw(VSTGUI::CDrawContext* context) SMTG_OVERRIDE;
+
+private:
+	static constexpr int32 kNumBins = AnalysisFrame::kNumSamples / 2;
+
+	float levels[kNumBins]; // in dB, falling back slowly
+};
+
+// Deviation of the sounding notes from equal temperament in Cents, one column per pitch class
+class TuningDeviationView : public AnalysisView
+{
+public:
+	using AnalysisView::AnalysisView;
+
+	void draw(VSTGUI::CDrawContext* context) SMTG_OVERRIDE;
+};
+
+}
+}
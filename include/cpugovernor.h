@@ -0,0 +1,56 @@
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <chrono>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Quality stages, each one includes the savings of the stages before it
+enum QualityLevel : int32
+{
+	kQualityFull = 0,
+	kQualityCheapOscillators,	// parabolic sinus instead of sin()
+	kQualityCoarseEnvelopes,	// envelopes are updated every 64 instead of every 16 samples
+	kQualityReducedPolyphony,	// at most MAX_VOICES / 4 voices, oldest voices are stolen
+
+	kNumQualityLevels
+};
+
+// Measures the time spent in PlugProcessor::process against the block deadline
+// and steps the quality level down under pressure and back up once the load dropped.
+class CpuGovernor
+{
+public:
+	void setup(double sampleRate, bool enabled);
+	void reset();
+
+	void beginBlock();
+	// Returns true if the quality level changed
+	bool endBlock(int32 numSamples);
+
+	int32 getQualityLevel() const { return qualityLevel; }
+	double getLoad() const { return smoothedLoad; } // in fractions of the block deadline
+
+	static constexpr double kHighLoad = 0.6;		// step down above this load
+	static constexpr double kLowLoad = 0.3;			// step up below this load...
+	static constexpr double kRecoveryTime = 1.0;	// ...if it stayed there that long (in s)
+	static constexpr double kHoldTime = 0.05;		// min time between two step downs (in s)
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	Clock::time_point blockStart;
+	double sampleRate = 44100.0;
+	double smoothedLoad = 0.0;
+	double samplesSinceChange = 0.0;
+	double samplesBelowLowLoad = 0.0;
+	int32 qualityLevel = kQualityFull;
+	bool enabled = true;
+};
+
+}
+}
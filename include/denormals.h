@@ -0,0 +1,72 @@
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <cmath>
+
+// The denormal benchmark builds the processor a second time with 0 to compare
+#ifndef BADTEMPERED_FLUSH_DENORMALS
+#define BADTEMPERED_FLUSH_DENORMALS 1
+#endif
+
+#if BADTEMPERED_FLUSH_DENORMALS && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#include <xmmintrin.h>
+#define BADTEMPERED_SSE_DENORMALS 1
+#endif
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Sets flush to zero and denormals are zero for the current thread and restores the host's
+// mode when it goes out of scope. Denormal operands are slower by orders of magnitude on most
+// CPUs, and decaying states like release tails and filter integrators run into them.
+class ScopedFlushDenormals
+{
+public:
+	ScopedFlushDenormals()
+	{
+#if BADTEMPERED_SSE_DENORMALS
+		previous = _mm_getcsr();
+		_mm_setcsr(previous | kFlushToZero | kDenormalsAreZero);
+#elif BADTEMPERED_FLUSH_DENORMALS && defined(__aarch64__)
+		__asm__ __volatile__("mrs %0, fpcr" : "=r"(previous));
+		__asm__ __volatile__("msr fpcr, %0" : : "r"(previous | kFlushToZero));
+#endif
+	}
+
+	~ScopedFlushDenormals()
+	{
+#if BADTEMPERED_SSE_DENORMALS
+		_mm_setcsr(previous);
+#elif BADTEMPERED_FLUSH_DENORMALS && defined(__aarch64__)
+		__asm__ __volatile__("msr fpcr, %0" : : "r"(previous));
+#endif
+	}
+
+	ScopedFlushDenormals(const ScopedFlushDenormals&) = delete;
+	ScopedFlushDenormals& operator=(const ScopedFlushDenormals&) = delete;
+
+private:
+#if BADTEMPERED_SSE_DENORMALS
+	static constexpr uint32 kFlushToZero = 0x8000; // MXCSR bits
+	static constexpr uint32 kDenormalsAreZero = 0x0040;
+	uint32 previous;
+#elif BADTEMPERED_FLUSH_DENORMALS && defined(__aarch64__)
+	static constexpr uint64 kFlushToZero = uint64(1) << 24; // FPCR.FZ, also covers inputs
+	uint64 previous;
+#endif
+};
+
+// Guard for states that decay toward zero, like filter integrators and feedback paths, for
+// hosts or threads where the mode above is not set. Far below audibility, but far above the
+// denormal range of float. Meant for once per sub-block, not per sample.
+template <class SamplePrecision>
+inline SamplePrecision flushTiny(SamplePrecision value)
+{
+	return std::fabs(value) < SamplePrecision(1e-15) ? SamplePrecision(0) : value;
+}
+
+}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "pluginterfaces/vst/ivstevents.h"
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// The events of one block, copied from the host's event list in a single pass,
+// sorted by sample offset and split by what handles them.
+class EventBuffer
+{
+public:
+	static constexpr int32 kMaxVoiceEvents = 2048;
+	static constexpr int32 kMaxRootNoteEvents = 256;
+
+	// Offsets outside of the block are moved to its last sample
+	void collect(Vst::IEventList* inputEvents, int32 numSamples);
+
+	// Note ons, note offs and note expressions of both buses
+	const Vst::Event* getVoiceEvents() const { return voiceEvents; }
+	int32 getNumVoiceEvents() const { return numVoiceEvents; }
+
+	// Note ons of the bass bus, they set the root note
+	const Vst::Event* getRootNoteEvents() const { return rootNoteEvents; }
+	int32 getNumRootNoteEvents() const { return numRootNoteEvents; }
+
+	// Number of events which didn't fit, they are dropped
+	int32 getNumDroppedEvents() const { return numDroppedEvents; }
+
+private:
+	static void insertSorted(Vst::Event* events, int32& numEvents, const Vst::Event& e);
+
+	Vst::Event voiceEvents[kMaxVoiceEvents];
+	Vst::Event rootNoteEvents[kMaxRootNoteEvents];
+	int32 numVoiceEvents = 0;
+	int32 numRootNoteEvents = 0;
+	int32 numDroppedEvents = 0;
+};
+
+}
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Approximations of the libm functions used by the voices. They are inline, free of branches
+// and table lookups, so loops calling them can be vectorised by the compiler.
+// Error bounds are measured against libm over the given input range.
+
+namespace FastMath {
+
+inline double fromBits(uint64 bits)
+{
+	double d;
+	memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+inline uint64 toBits(double d)
+{
+	uint64 bits;
+	memcpy(&bits, &d, sizeof(bits));
+	return bits;
+}
+
+// Taylor polynomial of sin(y) up to degree 11, y = 2 pi x for x in [-0.25, 0.25] turns
+inline double sin2PiReduced(double x)
+{
+	const double y = x * 6.28318530717958647693;
+	const double y2 = y * y;
+	double p = -1.0 / 39916800.0;
+	p = p * y2 + 1.0 / 362880.0;
+	p = p * y2 - 1.0 / 5040.0;
+	p = p * y2 + 1.0 / 120.0;
+	p = p * y2 - 1.0 / 6.0;
+	p = p * y2 + 1.0;
+
+	return y * p;
+}
+
+}
+
+// 2^x, relative error below 1e-8 for x in [-1022, 1023], inputs outside are clamped
+inline double fastExp2(double x)
+{
+	x = std::fmin(std::fmax(x, -1022.0), 1023.0);
+
+	// 2^x = 2^i * e^(f * ln 2) with f in [-0.5, 0.5]
+	const double i = std::floor(x + 0.5);
+	const double y = (x - i) * 0.69314718055994530942;
+
+	// Taylor polynomial up to degree 7
+	double p = 1.0 / 5040.0;
+	p = p * y + 1.0 / 720.0;
+	p = p * y + 1.0 / 120.0;
+	p = p * y + 1.0 / 24.0;
+	p = p * y + 1.0 / 6.0;
+	p = p * y + 0.5;
+	p = p * y + 1.0;
+	p = p * y + 1.0;
+
+	return p * FastMath::fromBits((uint64)((int64)i + 1023) << 52);
+}
+
+// log2(x) for normal x > 0, absolute error below 2e-9
+inline double fastLog2(double x)
+{
+	// x = m * 2^e with m in [sqrt(0.5), sqrt(2))
+	const uint64 bits = FastMath::toBits(x);
+	const uint64 mantissaBits = bits & 0x000fffffffffffffull;
+	const uint64 half = mantissaBits > 0x6a09e667f3bcdull ? 1 : 0; // mantissa above sqrt(2)
+	const double m = FastMath::fromBits(mantissaBits | ((1023 - half) << 52));
+	const double e = (double)((int64)(bits >> 52) - 1023 + (int64)half);
+
+	// log2(m) = 2 / ln 2 * atanh(t) with t = (m - 1) / (m + 1), |t| < 0.172
+	const double t = (m - 1.0) / (m + 1.0);
+	const double t2 = t * t;
+	double p = 1.0 / 9.0;
+	p = p * t2 + 1.0 / 7.0;
+	p = p * t2 + 1.0 / 5.0;
+	p = p * t2 + 1.0 / 3.0;
+	p = p * t2 + 1.0;
+
+	return e + 2.88539008177792681472 * t * p;
+}
+
+// e^x, relative error below 1e-8 for x in [-708, 709]
+inline double fastExp(double x)
+{
+	return fastExp2(x * 1.44269504088896340736);
+}
+
+// ln(x) for normal x > 0, absolute error below 1e-9
+inline double fastLog(double x)
+{
+	return fastLog2(x) * 0.69314718055994530942;
+}
+
+// base^exponent for base > 0, relative error below 1e-8 + 1e-9 * |exponent|
+inline double fastPow(double base, double exponent)
+{
+	return fastExp2(exponent * fastLog2(base));
+}
+
+// 10^(dB / 20), relative error below 1e-8
+inline double fastDbToFactor(double dB)
+{
+	return fastExp2(dB * 0.16609640474436811739); // log2(10) / 20
+}
+
+// sin(2 * pi * turns), absolute error below 6e-8
+inline double fastSin2Pi(double turns)
+{
+	// Reduce to [-0.25, 0.25] turns, sin(2 pi x) = sin(2 pi (0.5 - x))
+	double x = turns - std::floor(turns + 0.5);
+	const double ax = std::fabs(x);
+	x = std::copysign(std::fmin(ax, 0.5 - ax), x);
+
+	return FastMath::sin2PiReduced(x);
+}
+
+// sin(2 * pi * turns) for turns in [0, 1) as the oscillator phases, absolute error below 6e-8.
+// Without floor and fmin, so loops over it are vectorised with plain SSE2 too.
+inline double fastSin2PiPhase(double turns)
+{
+	double x = turns - (double)(int32)(turns + 0.5); // truncating is flooring here
+	const double ax = std::fabs(x);
+	x = std::copysign(std::min(ax, 0.5 - ax), x);
+
+	return FastMath::sin2PiReduced(x);
+}
+
+}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "pluginterfaces/vst/vsttypes.h"
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Entries of the list parameters, saved by index so they can grow
+enum LfoShapes : int32
+{
+	kLfoSine = 0,
+	kLfoTriangle,
+	kLfoSaw,
+	kLfoSquare,
+
+	kNumLfoShapes
+};
+
+enum ModulationSources : int32
+{
+	kModSourceNone = 0,
+	kModSourceLfo1,
+	kModSourceLfo2,
+
+	kNumModSources
+};
+
+enum ModulationDestinations : int32
+{
+	kModDestinationNone = 0,
+	kModDestinationPitch, // +-1200 Cents at full amount, on top of the tuning
+	kModDestinationVolume, // the gain destinations scale by 1 + amount * source, at least 0
+	kModDestinationSinusVolume,
+	kModDestinationSquareVolume,
+	kModDestinationSawVolume,
+	kModDestinationTriVolume,
+
+	kNumModDestinations
+};
+
+// Plain values of the modulation parameters
+struct ModulationSettings
+{
+	static constexpr int32 kNumLfos = 2;
+	static constexpr int32 kNumSlots = 4;
+
+	Vst::ParamValue lfoRate[kNumLfos]; // in Hz
+	int32 lfoShape[kNumLfos];
+
+	struct Slot
+	{
+		int32 source;
+		int32 destination;
+		Vst::ParamValue amount; // in [-1, 1]
+	};
+	Slot slots[kNumSlots];
+};
+
+// Free running LFOs routed through the modulation slots. The LFOs and slots are evaluated
+// at control rate only, every control interval samples, and the destinations are linearly
+// interpolated in between into per sample buffers which all voices read.
+class ModulationMatrix
+{
+public:
+	static constexpr int32 kMaxSamples = 64;
+	static constexpr int32 kDefaultControlInterval = 32;
+
+	void setSampleRate(Vst::ParamValue sampleRate);
+	void setControlInterval(int32 samples);
+	void reset();
+
+	void process(const ModulationSettings& settings, int32 numSamples);
+
+	// Valid for the numSamples of the last process call
+	bool isActive(int32 destination) const { return active[destination]; }
+	const Vst::ParamValue* getValues(int32 destination) const { return values[destination]; }
+
+	// Running state in units independent of the sample rate, saved with the voices
+	struct Snapshot
+	{
+		Vst::ParamValue lfoPhases[ModulationSettings::kNumLfos];
+		Vst::ParamValue current[kNumModDestinations];
+		Vst::ParamValue slope[kNumModDestinations]; // change per s
+		Vst::ParamValue toControlPoint; // in s
+		bool active[kNumModDestinations];
+	};
+	void getSnapshot(Snapshot& snapshot) const;
+	void setSnapshot(const Snapshot& snapshot);
+
+private:
+	void evaluate(const ModulationSettings& settings, Vst::ParamValue destinations[kNumModDestinations]);
+
+	Vst::ParamValue values[kNumModDestinations][kMaxSamples];
+	bool active[kNumModDestinations] = {};
+
+	Vst::ParamValue lfoPhases[ModulationSettings::kNumLfos] = {};
+	Vst::ParamValue controlPeriod = 0.0; // in s
+	int32 controlInterval = kDefaultControlInterval;
+	int32 samplesToControlPoint = 0;
+
+	// Destination values at the last control point and their change per sample until the next one
+	Vst::ParamValue current[kNumModDestinations] = {};
+	Vst::ParamValue step[kNumModDestinations] = {};
+};
+
+}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "pluginterfaces/vst/ivsteditcontroller.h"
+#include "pluginterfaces/vst/vsttypes.h"
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+using Vst::ParamValue;
+
+// How the normalized value maps to the plain one
+enum ParameterScale : int32
+{
+	kScaleNormalized = 0, // plain is normalized, shown as is
+	kScaleLinear,
+	kScaleLogarithmic, // for frequencies
+	kScaleList, // stepCount + 1 entries, plain is the index
+};
+
+// One exported parameter. The processor takes its ranges and defaults from here, the
+// controller also its titles, units and list entries.
+struct ParameterDescription
+{
+	Vst::ParamID id;
+	const Vst::TChar* title;
+	const Vst::TChar* shortTitle;
+	const Vst::TChar* units; // nullptr for none
+	ParameterScale scale;
+	ParamValue minPlain;
+	ParamValue maxPlain;
+	ParamValue defaultNormalized; // exactly what the processor starts with
+	int32 stepCount; // 0 for continuous
+	int32 precision; // decimals shown
+	int32 flags; // Vst::ParameterInfo::ParameterFlags
+	const Vst::TChar* const* listEntries; // kScaleList only
+
+	ParamValue toPlain(ParamValue normalized) const;
+	ParamValue toNormalized(ParamValue plain) const;
+	ParamValue getDefaultPlain() const { return toPlain(defaultNormalized); }
+};
+
+// All parameters but the presets of the multitimbral parts, which the controller numbers
+// itself, sorted by id
+struct ParameterTable
+{
+	static const ParameterDescription kEntries[];
+	static const int32 kNumEntries;
+
+	// nullptr for unknown ids
+	static const ParameterDescription* find(Vst::ParamID id);
+};
+
+}
+}
@@ -36,16 +36,55 @@
 
 #pragma once
 
+#include "../include/analysisfeed.h"
+
 #include "public.sdk/source/vst/vsteditcontroller.h"
+#include "pluginterfaces/vst/ivstnoteexpression.h"
 #include "vstgui/plugin-bindings/vst3editor.h"
+#include "vstgui/lib/cvstguitimer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace Benergy {
 namespace BadTempered {
 
 using namespace Steinberg;
 
+class AnalysisView;
+
+//-----------------------------------------------------------------------------
+// A parameter whose dependents are notified later, see DeferredParameterUpdates
+class DeferredParameterUpdate
+{
+public:
+	virtual ~DeferredParameterUpdate () = default;
+	virtual void sendUpdate () = 0;
+
+	bool updatePending = false;
+};
+
+//-----------------------------------------------------------------------------
+// Collects the changed parameters of the controller, so loading a state or a burst of
+// automation redraws every control once per editor frame and not once per change
+class DeferredParameterUpdates
+{
+public:
+	// Once for all parameters, add then never allocates
+	void reserve (size_t numParameters) { pending.reserve (numParameters); }
+	void clear () { pending.clear (); }
+
+	// Parameters already pending are only sent once
+	void add (DeferredParameterUpdate* update);
+	void flush ();
+
+private:
+	std::vector<DeferredParameterUpdate*> pending;
+};
+
 //-----------------------------------------------------------------------------
-class PlugController : public Vst::EditController, public VSTGUI::VST3EditorDelegate
+class PlugController : public Vst::EditController, public Vst::INoteExpressionController, public Vst::IMidiMapping, public VSTGUI::VST3EditorDelegate
 {
 public:
 //------------------------------------------------------------------------
@@ -59,10 +98,51 @@ public:
 
 	//---from IPluginBase--------
 	tresult PLUGIN_API initialize (FUnknown* context) SMTG_OVERRIDE;
+	tresult PLUGIN_API terminate () SMTG_OVERRIDE;
 
 	//---from EditController-----
 	IPlugView* PLUGIN_API createView (const char* name) SMTG_OVERRIDE;
 	tresult PLUGIN_API setComponentState (IBStream* state) SMTG_OVERRIDE;
+	tresult PLUGIN_API notify (Vst::IMessage* message) SMTG_OVERRIDE;
+
+	//---from VST3EditorDelegate-----
+	VSTGUI::CView* createCustomView (const char* name, const VSTGUI::UIAttributes& attributes, const VSTGUI::IUIDescription* description, VSTGUI::VST3Editor* editor) SMTG_OVERRIDE;
+	void didOpen (VSTGUI::VST3Editor* editor) SMTG_OVERRIDE;
+	void willClose (VSTGUI::VST3Editor* editor) SMTG_OVERRIDE;
+
+	//---from INoteExpressionController---
+	int32 PLUGIN_API getNoteExpressionCount (int32 busIndex, int16 channel) SMTG_OVERRIDE;
+	tresult PLUGIN_API getNoteExpressionInfo (int32 busIndex, int16 channel, int32 noteExpressionIndex, Vst::NoteExpressionTypeInfo& info) SMTG_OVERRIDE;
+	tresult PLUGIN_API getNoteExpressionStringByValue (int32 busIndex, int16 channel, Vst::NoteExpressionTypeID id, Vst::NoteExpressionValue valueNormalized, Vst::String128 string) SMTG_OVERRIDE;
+	tresult PLUGIN_API getNoteExpressionValueByString (int32 busIndex, int16 channel, Vst::NoteExpressionTypeID id, const Vst::TChar* string, Vst::NoteExpressionValue& valueNormalized) SMTG_OVERRIDE;
+
+	//---from IMidiMapping-----------
+	tresult PLUGIN_API getMidiControllerAssignment (int32 busIndex, int16 channel, Vst::CtrlNumber midiControllerNumber, Vst::ParamID& id) SMTG_OVERRIDE;
+
+	OBJ_METHODS (PlugController, EditController)
+	DEFINE_INTERFACES
+		DEF_INTERFACE (INoteExpressionController)
+		DEF_INTERFACE (IMidiMapping)
+	END_DEFINE_INTERFACES (EditController)
+	REFCOUNT_METHODS (EditController)
+
+	//---Preset banks, see PresetBank---
+	// Lets the processor map the bank, its presets are then selected with the Preset parameter or by name
+	tresult loadPresetBank (const std::string& path);
+	// Channel 1 to 15 selects the preset of that channel's part, see kPartPresetId
+	tresult selectPreset (const std::string& name, int32 channel = 0);
+
+protected:
+	void updateAnalysisViews ();
+
+	// Output of the processor for the meters, polled by mFrameTimer
+	std::shared_ptr<AnalysisFeed> mAnalysisFeed;
+	AnalysisFrame mAnalysisFrame = {};
+	std::vector<AnalysisView*> mAnalysisViews;
+	VSTGUI::SharedPointer<VSTGUI::CVSTGUITimer> mFrameTimer;
+
+	// Sent by mFrameTimer while the editor is open
+	DeferredParameterUpdates mParameterUpdates;
 };
 
 //------------------------------------------------------------------------
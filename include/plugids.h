@@ -37,6 +37,8 @@
 #pragma once
 
 #define MAX_VOICES 64
+#define MAX_PARTS 16 // one per MIDI channel
+#define MAX_OUTPUT_BUSES 4 // stereo, the main one and the stems
 
 namespace Benergy {
 namespace BadTempered {
@@ -47,10 +49,12 @@ using namespace Steinberg;
 enum BadTemperedParams : Vst::ParamID
 {
 	kBypassId = 100,
+	kPresetId,
 
 	kVolumeId = 200,
 	kTuningId,
 	kRootNoteId,
+	kRootModeId,
 
 	kAttackId = 300,
 	kDecayId,
@@ -60,7 +64,51 @@ enum BadTemperedParams : Vst::ParamID
 	kSinusVolumeId = 400,
 	kSquareVolumeId,
 	kSawVolumeId,
-	kTriVolumeId
+	kTriVolumeId,
+
+	kQualityLevelId = 500,
+
+	kUnisonVoicesId = 600,
+	kUnisonDetuneId,
+
+	kFilterCutoffId = 700,
+	kFilterResonanceId,
+	kFilterEnvelopeId,
+
+	kLfo1RateId = 800,
+	kLfo1ShapeId,
+	kLfo2RateId,
+	kLfo2ShapeId,
+
+	kMod1SourceId = 900,
+	kMod1DestinationId,
+	kMod1AmountId,
+	kMod2SourceId,
+	kMod2DestinationId,
+	kMod2AmountId,
+	kMod3SourceId,
+	kMod3DestinationId,
+	kMod3AmountId,
+	kMod4SourceId,
+	kMod4DestinationId,
+	kMod4AmountId,
+
+	// Program of the part on MIDI channel 1 to 15 is kPartPresetId + channel,
+	// channel 0 plays the main parameters
+	kPartPresetId = 1000,
+
+	// Pedals of all channels, mapped to CC 64 and 66
+	kSustainPedalId = 1100,
+	kSostenutoPedalId,
+	kRepeatedNotesId,
+
+	kOutputRoutingId = 1200,
+	kSplitKey1Id,
+	kSplitKey2Id,
+	kSplitKey3Id,
+
+	// Saves the playing voices with the state
+	kSaveVoicesId = 1300
 };
 
 
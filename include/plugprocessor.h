@@ -36,18 +36,33 @@
 
 #pragma once
 
+#include "../include/cpugovernor.h"
+#include "../include/eventbuffer.h"
+#include "../include/presetbank.h"
+#include "../include/rootfollower.h"
+#include "../include/statechunks.h"
+#include "../include/triplebuffer.h"
 #include "../include/voice.h"
+#include "../include/voiceprocessor.h"
 
 #include "public.sdk/source/vst/vstaudioeffect.h"
-#include "public.sdk/samples/vst/common/voiceprocessor.h"
+
+#include "../include/plugids.h" // needs the SDK types
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace Benergy {
 namespace BadTempered {
 
 using namespace Steinberg;
 
+class AnalysisFeed;
+
 //-----------------------------------------------------------------------------
-class PlugProcessor : public Vst::AudioEffect
+class PlugProcessor : public Vst::AudioEffect, public StateChunkHandler
 {
 public:
 	PlugProcessor ();
@@ -60,18 +75,100 @@ public:
 	tresult PLUGIN_API setupProcessing (Vst::ProcessSetup& setup) SMTG_OVERRIDE;
 	tresult PLUGIN_API setActive (TBool state) SMTG_OVERRIDE;
 	tresult PLUGIN_API process (Vst::ProcessData& data) SMTG_OVERRIDE;
+	uint32 PLUGIN_API getTailSamples () SMTG_OVERRIDE;
 
 //------------------------------------------------------------------------
 	tresult PLUGIN_API setState (IBStream* state) SMTG_OVERRIDE;
 	tresult PLUGIN_API getState (IBStream* state) SMTG_OVERRIDE;
 
+	tresult PLUGIN_API connect (Vst::IConnectionPoint* other) SMTG_OVERRIDE;
+	tresult PLUGIN_API notify (Vst::IMessage* message) SMTG_OVERRIDE;
+
 	static FUnknown* createInstance (void*) { return (Vst::IAudioProcessor*)new PlugProcessor (); }
 
+	// For the OfflineRenderer in tools, which starts rendering in the middle of a timeline.
+	// Not while processing.
+	bool followsChords() const { return mParameterState.followChords(); }
+	void setRootNote(int32 pitch);
+	void discardRestoredVoices() { mRestoredVoices.update(); } // from the last setState
+
 protected:
+	using BadTemperedVoiceProcessor = VoiceProcessor<float, Voice<float>, 2, MAX_VOICES, GlobalParameterState>;
+
+	void applyQualityLevel(int32 level);
+	void applyPartPreset(int32 channel, const PresetRecord& preset);
+	struct PartSet;
+	void applyPartSet(const PartSet& partSet);
+	void addPedalChange(Vst::ParamID id, int32 sampleOffset, Vst::ParamValue value, int32 numSamples);
+	void applyPedalChanges(int32& index, int32 sampleOffset);
+
+	//---from StateChunkHandler-----
+	void readChunk(uint32 tag, StateReader& chunk) SMTG_OVERRIDE;
+	void writeChunks(StateWriter& writer) SMTG_OVERRIDE;
+
+	bool loadPresetBank(const std::string& path);
+	void reportParameters(Vst::IParameterChanges* outputParameterChanges);
+
 	Vst::ProcessSetup mProcessSetup;
-	Vst::VoiceProcessor* mVoiceProcessor = nullptr;
+	BadTemperedVoiceProcessor* mVoiceProcessor = nullptr;
 	GlobalParameterState mParameterState;
 
+	// Multitimbral parts, indexed by MIDI channel. A channel plays mParameterState until its
+	// part got a preset of its own, channel 0 always plays mParameterState.
+	GlobalParameterState mParts[MAX_PARTS];
+	bool mPartActive[MAX_PARTS] = {};
+	std::atomic<const PresetRecord*> mPendingPartPresets[MAX_PARTS];
+
+	// The parameters of a state, read by setState and switched to by the audio thread at the
+	// start of a block, or right away while inactive
+	struct PartSet
+	{
+		ParameterValues main;
+		uint32 activeParts; // channel bits
+		ParameterValues parts[MAX_PARTS];
+	};
+	TripleBuffer<PartSet> mLoadedPartSets;
+	const PartSet* mSavedPartSet = nullptr; // saved by getState instead while the audio thread didn't take it
+
+	// Sustain and sostenuto points of the current block, sorted by offset. The block is split
+	// at them like at root notes, so the pedals are sample accurate.
+	struct PedalChange
+	{
+		int32 sampleOffset;
+		Vst::ParamID id;
+		bool down;
+	};
+	static constexpr int32 kMaxPedalChanges = 64;
+	PedalChange mPedalChanges[kMaxPedalChanges];
+	int32 mNumPedalChanges = 0;
+	EventBuffer mEventBuffer;
+	RootNoteFollower mRootFollower;
+	CpuGovernor mCpuGovernor;
+	std::shared_ptr<AnalysisFeed> mAnalysisFeed; // shared with the controller for its meters
+
+	// Voices with the smoothing and modulation of the parts they play. The audio thread
+	// publishes them for getState, which saves the last ones without waiting, and setState
+	// hands them to it.
+	struct VoiceSnapshot
+	{
+		BadTemperedVoiceProcessor::Snapshot voices;
+		GlobalParameterState::Snapshot parts[MAX_PARTS]; // by MIDI channel, 0 is mParameterState
+	};
+	void getVoiceSnapshot(VoiceSnapshot& snapshot) const;
+	void setVoiceSnapshot(const VoiceSnapshot& snapshot);
+	void publishVoiceSnapshot();
+	TripleBuffer<VoiceSnapshot> mSavedVoices;
+	TripleBuffer<VoiceSnapshot> mRestoredVoices;
+	int32 mSamplesToVoiceSnapshot = 0;
+	bool mVoicesSounded = false; // at the end of the last block
+	uint32 mActiveOutputBuses = 1; // bit per bus, taken when activated
+	bool mQualityLevelChanged = false;
+
+	// Presets are switched by handing a record of the mapped bank to the audio thread
+	std::vector<std::unique_ptr<PresetBank>> mPresetBanks; // every bank loaded while active, the last one is current
+	std::atomic<PresetBank*> mPresetBank {nullptr};
+	std::atomic<const PresetRecord*> mPendingPreset {nullptr};
+
 };
 
 //------------------------------------------------------------------------
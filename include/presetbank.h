@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../include/voice.h"
+
+#include <string>
+#include <vector>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Preset bank file layout (little endian):
+//   PresetBankHeader
+//   numPresets records of recordSize bytes at recordsOffset, each starting with a PresetRecord
+//   numPresets PresetIndexEntry at indexOffset, sorted by name hash
+// recordSize may grow in later versions, fields are only ever appended to PresetRecord.
+// The parameters are id and value pairs like in the parameters chunk of the state, so
+// parameters added later only add pairs. Version 1 had fixed fields for the first twelve.
+
+struct PresetBankHeader
+{
+	uint32 magic;
+	uint32 version; // of the layout, banks of other versions are not opened
+	uint32 numPresets;
+	uint32 recordSize;
+	uint64 recordsOffset;
+	uint64 indexOffset;
+};
+
+struct PresetRecord
+{
+	char name[48]; // UTF-8, zero terminated
+	uint64 nameHash;
+
+	double customTuning[12]; // in Cents
+
+	uint32 valuesOffset; // of the PresetValues, from the start of the record
+	uint32 numValues;
+};
+
+// Like in the parameters chunk, normalized or the index for lists
+struct PresetValue
+{
+	uint32 id;
+	uint32 reserved;
+	double value;
+};
+
+struct PresetIndexEntry
+{
+	uint64 nameHash;
+	uint32 recordIndex;
+	uint32 reserved;
+};
+
+// Read-only, memory mapped preset bank. All lookups are allocation free and the records
+// are used in place, so presets can be picked from the audio thread.
+class PresetBank
+{
+public:
+	~PresetBank();
+
+	bool open(const std::string& path);
+	void close();
+
+	bool isOpen() const { return header != nullptr; }
+	const std::string& getPath() const { return path; }
+
+	int32 getNumPresets() const { return header ? (int32)header->numPresets : 0; }
+	const PresetRecord* getPreset(int32 index) const;
+	const PresetRecord* findPreset(uint64 nameHash) const;
+	const PresetRecord* findPreset(const char* name) const;
+
+	static uint64 hashName(const char* name);
+
+	// Parameters the record has no value for get their defaults, the bypass is left as it is
+	static void applyRecord(const PresetRecord& record, GlobalParameterState& state);
+
+	struct Preset
+	{
+		std::string name;
+		ParameterValues values;
+	};
+	static bool write(const std::string& path, const std::vector<Preset>& presets);
+
+private:
+	std::string path;
+	const uint8* data = nullptr;
+	uint64 size = 0;
+	const PresetBankHeader* header = nullptr;
+	const PresetIndexEntry* index = nullptr;
+
+#if SMTG_OS_WINDOWS
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
+
+}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "pluginterfaces/vst/ivstevents.h"
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Set of MIDI pitches, one bit each
+struct NoteSet
+{
+	uint64 bits[2] = {};
+
+	void add(int32 pitch) { bits[(pitch >> 6) & 1] |= uint64(1) << (pitch & 63); }
+	void remove(int32 pitch) { bits[(pitch >> 6) & 1] &= ~(uint64(1) << (pitch & 63)); }
+	bool contains(int32 pitch) const { return (bits[(pitch >> 6) & 1] >> (pitch & 63)) & 1; }
+	bool empty() const { return (bits[0] | bits[1]) == 0; }
+	void clear() { bits[0] = bits[1] = 0; }
+
+	// Lowest pitch, -1 if empty
+	int32 lowest() const;
+
+	// Bit per pitch class, C is bit 0
+	uint32 getPitchClasses() const;
+};
+
+// Follows the harmonic root of the held notes of both event buses, for the Chord Root mode
+// of the root note. The notes are tracked per event in O(1), the chord is recognized once
+// per block from its pitch classes with a lookup table.
+class RootNoteFollower
+{
+public:
+	void reset();
+
+	// Note ons and offs of both buses, other events are ignored
+	void processEvent(const Vst::Event& e);
+
+	// Pitch of the chord's root, the lowest held note of its pitch class. Among equally good
+	// roots the bass decides. -1 while no note is held.
+	int32 findRoot() const;
+
+private:
+	NoteSet bassNotes;
+	NoteSet mainNotes;
+};
+
+}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "pluginterfaces/vst/vsttypes.h"
+
+#include <memory>
+#include <vector>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Read-only data which only depends on the sample rate. All instances running at the same
+// sample rate share one set, it is created by the first of them and freed with the last one.
+class SampleRateResources
+{
+public:
+	// Not for the audio thread, it may allocate and locks
+	static std::shared_ptr<const SampleRateResources> acquire(Vst::ParamValue sampleRate);
+
+	Vst::ParamValue getSampleRate() const { return sampleRate; }
+
+	// Phase increment per sample of a MIDI pitch in one of the Tunings with its root note,
+	// A4 = 440 Hz in equal step tuning. Custom tuning has the equal step ones.
+	Vst::ParamValue getPhaseIncrement(int32 tuning, int32 pitch, int32 rootPitch) const
+	{
+		return phaseIncrements[((tuning * 12 + (rootPitch % 12 + 12) % 12) << 7) + (pitch & 127)];
+	}
+
+	explicit SampleRateResources(Vst::ParamValue sampleRate);
+
+private:
+	Vst::ParamValue sampleRate;
+	std::vector<Vst::ParamValue> phaseIncrements; // by tuning, root pitch class and pitch
+};
+
+}
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "pluginterfaces/base/ibstream.h"
+
+#include <cstring>
+#include <vector>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Building blocks of the state format, see GlobalParameterState::setState.
+// Everything is little endian, as are all supported platforms.
+
+constexpr uint32 makeChunkTag(char a, char b, char c, char d)
+{
+	return uint32(a) | (uint32(b) << 8) | (uint32(c) << 16) | (uint32(d) << 24);
+}
+
+class StateWriter
+{
+public:
+	template <class T>
+	void write(const T& value)
+	{
+		writeBytes(&value, sizeof(T));
+	}
+
+	void writeBytes(const void* data, size_t numBytes)
+	{
+		const uint8* bytes = static_cast<const uint8*>(data);
+		buffer.insert(buffer.end(), bytes, bytes + numBytes);
+	}
+
+	void beginChunk(uint32 tag)
+	{
+		write(tag);
+		chunkSizePos = buffer.size();
+		write(uint32(0));
+	}
+
+	void endChunk()
+	{
+		const uint32 size = (uint32)(buffer.size() - chunkSizePos - sizeof(uint32));
+		memcpy(&buffer[chunkSizePos], &size, sizeof(uint32));
+	}
+
+	const uint8* data() const { return buffer.data(); }
+	size_t size() const { return buffer.size(); }
+
+	// Writes everything with one call
+	tresult flush(IBStream* stream)
+	{
+		int32 numBytesWritten = 0;
+		if (stream->write(buffer.data(), (int32)buffer.size(), &numBytesWritten) != kResultOk || numBytesWritten != (int32)buffer.size())
+			return kResultFalse;
+		return kResultTrue;
+	}
+
+private:
+	std::vector<uint8> buffer;
+	size_t chunkSizePos = 0;
+};
+
+class StateReader
+{
+public:
+	StateReader(const uint8* data = nullptr, size_t size = 0) : data(data), size(size) {}
+
+	template <class T>
+	bool read(T& value)
+	{
+		return readBytes(&value, sizeof(T));
+	}
+
+	bool readBytes(void* dest, size_t numBytes)
+	{
+		if (numBytes > size - pos)
+			return false;
+		memcpy(dest, data + pos, numBytes);
+		pos += numBytes;
+		return true;
+	}
+
+	// Returns a reader for the next numBytes and skips them
+	bool sub(size_t numBytes, StateReader& reader)
+	{
+		if (numBytes > size - pos)
+			return false;
+		reader = StateReader(data + pos, numBytes);
+		pos += numBytes;
+		return true;
+	}
+
+	size_t remaining() const { return size - pos; }
+	bool atEnd() const { return pos == size; }
+
+private:
+	const uint8* data;
+	size_t size;
+	size_t pos = 0;
+};
+
+// Reads the rest of the stream, with a single read when the stream can tell its size
+inline bool readStream(IBStream* stream, std::vector<uint8>& buffer)
+{
+	const int32 kReadSize = 4096;
+	const int64 kMaxStateSize = 16 << 20;
+
+	int64 start = 0;
+	int64 end = 0;
+	if (stream->tell(&start) == kResultOk && stream->seek(0, IBStream::kIBSeekEnd, &end) == kResultOk
+		&& stream->seek(start, IBStream::kIBSeekSet, nullptr) == kResultOk && end >= start)
+	{
+		if (end - start > kMaxStateSize)
+			return false;
+		buffer.resize((size_t)(end - start));
+		int32 numBytesRead = 0;
+		if (buffer.empty() || stream->read(buffer.data(), (int32)buffer.size(), &numBytesRead) != kResultOk)
+			numBytesRead = 0;
+		if (numBytesRead == (int32)buffer.size())
+			return true;
+		buffer.resize(numBytesRead); // the size was wrong, go on reading the rest in steps
+	}
+
+	for (;;)
+	{
+		const size_t oldSize = buffer.size();
+		buffer.resize(oldSize + kReadSize);
+		int32 numBytesRead = 0;
+		if (stream->read(&buffer[oldSize], kReadSize, &numBytesRead) != kResultOk)
+			numBytesRead = 0;
+		buffer.resize(oldSize + numBytesRead);
+		if (numBytesRead < kReadSize)
+			return true;
+		if ((int64)buffer.size() >= kMaxStateSize)
+			return false;
+	}
+}
+
+// Chunks next to the parameters, e.g. from the processor
+class StateChunkHandler
+{
+public:
+	virtual ~StateChunkHandler() {}
+
+	// Called for every chunk the parameter state doesn't know, after the whole state was read
+	virtual void readChunk(uint32 tag, StateReader& chunk) = 0;
+	virtual void writeChunks(StateWriter& writer) = 0;
+};
+
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <atomic>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Lock-free single producer, single consumer triple buffer. The producer always has a buffer
+// to write and the consumer always has the latest complete one to read, neither ever waits.
+template <class T>
+class TripleBuffer
+{
+public:
+	// Producer
+	T& getWriteBuffer() { return buffers[writeIndex]; }
+	void publish()
+	{
+		publishedIndex = writeIndex;
+		writeIndex = state.exchange(writeIndex | kNewData, std::memory_order_acq_rel) & kIndexMask;
+	}
+	// The last published buffer stays as it is until the next publish, whether the consumer
+	// took it or not. isPending tells whether it did not yet.
+	const T& getPublishedBuffer() const { return buffers[publishedIndex]; }
+	bool isPending() const { return (state.load(std::memory_order_acquire) & kNewData) != 0; }
+
+	// Consumer, returns false and keeps the current read buffer if nothing was published since
+	bool update()
+	{
+		if (!(state.load(std::memory_order_relaxed) & kNewData))
+			return false;
+		readIndex = state.exchange(readIndex, std::memory_order_acq_rel) & kIndexMask;
+		return true;
+	}
+	const T& getReadBuffer() const { return buffers[readIndex]; }
+
+private:
+	static constexpr uint32 kIndexMask = 3;
+	static constexpr uint32 kNewData = 4;
+
+	T buffers[3] = {};
+	std::atomic<uint32> state {1}; // index of the buffer between producer and consumer, and kNewData
+	uint32 writeIndex = 0;
+	uint32 publishedIndex = 1;
+	uint32 readIndex = 2;
+};
+
+}
+}
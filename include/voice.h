@@ -1,7 +1,15 @@
 #pragma once
 
-#include "public.sdk/samples/vst/common/voicebase.h"
+#include "../include/cpugovernor.h"
+#include "../include/fastmath.h"
+#include "../include/modulation.h"
+#include "../include/sharedresources.h"
+#include "../include/voicefilter.h"
+
 #include "pluginterfaces/base/ibstream.h"
+#include "pluginterfaces/vst/ivstnoteexpression.h"
+
+#include <algorithm>
 
 
 //#define _USE_MATH_DEFINES
@@ -21,11 +29,138 @@ namespace BadTempered {
 using namespace Steinberg;
 using ParamValue = Vst::ParamValue;
 
-struct GlobalParameterState
+class StateChunkHandler;
+class StateReader;
+class StateWriter;
+
+// Entries of the tuning list parameter, saved by index so new tunings can be appended
+enum Tunings : int32
+{
+	kEqualStepTuning = 0,
+	kPythagoreanTuning,
+	kWerckmeisterIIITuning,
+	kMeantoneTuning,
+	kCustomTuning,
+	kKirnbergerIIITuning,
+	kVallottiTuning,
+	kJustTuning, // 5-limit, with 16/15, 9/5 and 45/32
+
+	kNumTunings
+};
+
+// Where the root note of the tuning comes from
+enum RootModes : int32
+{
+	kRootLastBassNote = 0, // note ons of the bass bus
+	kRootChordRoot, // root of the chord held on both buses, see RootNoteFollower
+
+	kNumRootModes
+};
+
+// What a note on does when the same pitch still sounds in the part
+enum RepeatedNoteModes : int32
+{
+	kRepeatedNotesNewVoice = 0,
+	kRepeatedNotesReuseVoice, // retriggers the sounding voice from its current level
+
+	kNumRepeatedNoteModes
+};
+
+// Which output bus a note plays on, see GlobalParameterState::getOutputBus
+enum OutputRoutings : int32
+{
+	kRouteMainOnly = 0,
+	kRouteByChannel, // MIDI channel modulo the number of buses
+	kRouteByKeyRange, // the split keys start the next bus
+
+	kNumOutputRoutings
+};
+
+// Per sample values of the global parameters which all voices read, smoothed and modulated
+// once per rendered sub-block so the cost doesn't grow with the number of voices
+struct SmoothedParameters
+{
+	enum Index
+	{
+		kVolume = 0, // as factor
+		kSinusVolume, // the waveform volumes include their 0.25 mix factor
+		kSquareVolume,
+		kSawVolume,
+		kTriVolume,
+		kPitchRatio, // from the modulation matrix only
+
+		kNumSmoothed
+	};
+
+	static constexpr int32 kMaxSamples = 64;
+
+	void setSampleRate(ParamValue _sampleRate);
+	void jumpTo(const ParamValue targets[kNumSmoothed]);
+	void smooth(const ParamValue targets[kNumSmoothed], int32 numSamples);
+
+	ParamValue values[kNumSmoothed][kMaxSamples];
+	ParamValue current[kNumSmoothed];
+	ParamValue coeff;
+};
+
+// Frequency ratios of the unison oscillators, shared by all voices
+struct UnisonSpread
+{
+	static constexpr int32 kMaxOscillators = 16;
+
+	// Spreads the oscillators evenly over [-detuneCents, detuneCents]
+	void update(int32 _numOscillators, ParamValue detuneCents);
+
+	int32 numOscillators = 1;
+	ParamValue ratios[kMaxOscillators] = { 1.0 };
+	ParamValue gain = 1.0; // keeps the loudness about the same for any number of oscillators
+};
+
+// Low pass settings shared by all voices
+struct FilterSettings
+{
+	void update(ParamValue cutoff, ParamValue resonance, ParamValue envelopeAmount, ParamValue _sampleRate);
+
+	bool enabled = false; // fully open and not moved by the envelope, the voices skip the filter
+	ParamValue cutoffRatio = 0.49; // cutoff / sample rate
+	ParamValue g = 0.0;
+	ParamValue k = 2.0;
+	ParamValue envelopeOctaves = 0.0; // cutoff shift at full envelope level
+};
+
+// Groups of parameters whose derived values are recomputed together
+enum DirtyFlags : uint32
+{
+	kDirtyGains = 1 << 0, // volume and waveform volumes
+	kDirtyEnvelope = 1 << 1,
+	kDirtyUnison = 1 << 2,
+	kDirtyFilter = 1 << 3,
+	kDirtyModulation = 1 << 4,
+
+	kDirtyAll = 0xffffffff
+};
+
+// Values the voices need in plain units, derived from the normalized parameters
+struct DerivedParameters
+{
+	ParamValue gainTargets[SmoothedParameters::kNumSmoothed]; // targets of SmoothedParameters
+
+	ParamValue attackTime; // in s
+	ParamValue attackSamples;
+	ParamValue decayTime; // in s
+	ParamValue releaseTime; // in s
+
+	ModulationSettings modulation;
+};
+
+// The saved parameters, normalized, without anything derived from them. Plain values only, so
+// they can be copied or handed to the audio thread without touching the processing state.
+struct ParameterValues
 {
 	ParamValue volume;
 	ParamValue tuning;
 	ParamValue rootNote;
+	ParamValue rootMode;
 
 	ParamValue attack;
 	ParamValue decay;
@@ -37,90 +172,276 @@ struct GlobalParameterState
 	ParamValue sawVolume;
 	ParamValue triVolume;
 
+	ParamValue unisonVoices;
+	ParamValue unisonDetune;
+
+	ParamValue filterCutoff;
+	ParamValue filterResonance;
+	ParamValue filterEnvelope;
+
+	ParamValue lfo1Rate;
+	ParamValue lfo1Shape;
+	ParamValue lfo2Rate;
+	ParamValue lfo2Shape;
+
+	ParamValue mod1Source;
+	ParamValue mod1Destination;
+	ParamValue mod1Amount;
+	ParamValue mod2Source;
+	ParamValue mod2Destination;
+	ParamValue mod2Amount;
+	ParamValue mod3Source;
+	ParamValue mod3Destination;
+	ParamValue mod3Amount;
+	ParamValue mod4Source;
+	ParamValue mod4Destination;
+	ParamValue mod4Amount;
+
+	ParamValue repeatedNotes;
+
+	ParamValue outputRouting;
+	ParamValue splitKey1;
+	ParamValue splitKey2;
+	ParamValue splitKey3;
+
+	ParamValue saveVoices;
+
 	bool bypass;
 
-	tresult setState(IBStream* stream);
-	tresult getState(IBStream* stream);
+	ParamValue customTuning[12]; // in Cents per interval above the root note
+
+	void setDefaults();
+
+	// The chunks of the saved parameters, also nested in the chunks of the multitimbral parts.
+	// readParameterChunk returns kNotImplemented for other tags.
+	tresult readParameterChunk(uint32 tag, StateReader& chunk);
+	void writeParameterChunks(StateWriter& writer) const;
+
+	// The whole state, extraChunks reads and writes the chunks which are not part of the
+	// parameters. A broken state leaves the values as they are.
+	tresult setState(IBStream* stream, StateChunkHandler* extraChunks = nullptr);
+	tresult getState(IBStream* stream, StateChunkHandler* extraChunks = nullptr) const;
+
+	// All ParamValue members with their parameter ids, bypass is not included
+	struct SavedParameter
+	{
+		Vst::ParamID id;
+		ParamValue ParameterValues::* value;
+		int32 numListEntries; // lists are saved by index, 0 for other parameters
+	};
+	static const SavedParameter kSavedParameters[];
+	static const int32 kNumSavedParameters;
+
+	// For the host, all saved values are normalized but the root note, which is a MIDI pitch
+	// sent as pitch / 128 like in PlugProcessor::process
+	ParamValue getNormalized(const SavedParameter& param) const;
+
+	// Values as in the parameters chunk and preset banks, the index for lists. Ids this
+	// version doesn't save are ignored.
+	double getSavedValue(const SavedParameter& param) const;
+	void setSavedValue(Vst::ParamID id, double value);
+};
+
+struct GlobalParameterState : ParameterValues
+{
+	int32 qualityLevel; // set by the CpuGovernor, not saved
+
+	// Not saved, only valid while processing
+	uint32 dirty; // DirtyFlags of the parameters changed since the last updateDerived
+	DerivedParameters derived;
+	SmoothedParameters smoothed;
+	UnisonSpread unison;
+	FilterSettings filter;
+	ModulationMatrix modulation;
+	ParamValue processSampleRate;
+	std::shared_ptr<const SampleRateResources> resources; // shared with the other instances
+
+	// Sets a saved parameter and marks its derived values dirty
+	void setParameter(Vst::ParamID id, ParamValue value);
+	void markAllDirty() { dirty = kDirtyAll; }
+
+	// Recomputes the derived values of the dirty parameters, once per block before rendering
+	void updateDerived();
+
+	// Also marks everything dirty
+	void setDefaults();
+	int32 getTuning() const;
+	int32 getUnisonVoices() const;
+	bool followChords() const { return toListIndex(rootMode, kNumRootModes) == kRootChordRoot; }
+	bool reuseVoices() const { return toListIndex(repeatedNotes, kNumRepeatedNoteModes) == kRepeatedNotesReuseVoice; }
+	int32 getOutputBus(int32 channel, int32 pitch) const;
+	bool savesVoices() const { return saveVoices > 0.5; }
+	void getModulationSettings(ModulationSettings& settings) const;
+
+	// Called by the VoiceProcessor when it is created and before each sub-block it renders
+	static constexpr int32 kMaxSubBlockSize = SmoothedParameters::kMaxSamples;
+	void setupProcessing(ParamValue _sampleRate);
+	void prepareSubBlock(int32 numSamples);
+
+	// Smoothing and modulation state, saved with the voices that play the part
+	struct Snapshot
+	{
+		ParamValue smoothed[SmoothedParameters::kNumSmoothed];
+		ModulationMatrix::Snapshot modulation;
+	};
+	void getSnapshot(Snapshot& snapshot) const;
+	void setSnapshot(const Snapshot& snapshot);
 
-	static std::tuple<ParamValue, ParamValue, ParamValue> getMinMaxDefaultForParam(int paramID);
 	static ParamValue paramToPlain(ParamValue normalized, int paramID);
+	static int32 toListIndex(ParamValue normalized, int32 numListEntries);
+	static uint32 getDirtyFlags(Vst::ParamID id);
 };
 
+// Note expressions, the indices are the expression type ids
 enum VoiceParameters
 {
-	kNumParameters = 1
-};
+	kVolumeExpression = Vst::kVolumeTypeID,
+	kPanExpression = Vst::kPanTypeID,
+	kTuningExpression = Vst::kTuningTypeID,
 
-//class VoiceStaticsOnce;
+	kNumParameters
+};
 
+// Tuning offsets in Cents from equal step tuning
 class VoiceStatics
 {
-	friend class VoiceStaticsOnce;
-
 public:
-	static double getPythagoreanOffset(int32 pitch, int32 rootPitch);
-	static double getWerckmeisterIIIOffset(int32 pitch, int32 rootPitch);
-	static double getMeantoneOffset(int32 pitch, int32 rootPitch);
-
-private:
-	static double pythagoreanOffsets[12]; // in Cents
-	static double werckmeisterIIIOffsets[12]; // in Cents
-	static double meantoneOffsets[12]; // in Cents
+	// Of the fixed tunings, 0 for equal step and custom tuning. SampleRateResources turns them
+	// into phase increments, so a tuning added here costs nothing while playing.
+	static double getOffset(int32 tuning, int32 pitch, int32 rootPitch);
+	static double getCustomOffset(const GlobalParameterState& state, int32 pitch, int32 rootPitch);
 };
 
+// One note, rendered by the VoiceProcessor. Not derived from Vst::VoiceBase: the processor
+// always knows the concrete type, so nothing needs to be virtual, and the members are laid out
+// by how often they are used. The members of a sub-block and of the sample loop have a cache
+// line each, so scanning or rendering many voices only touches those lines.
 template<class SamplePrecision>
-class Voice : public Vst::VoiceBase<kNumParameters, SamplePrecision, 2, GlobalParameterState>
+class Voice
 {
 public:
-	bool process(SamplePrecision* outputBuffers[2], int32 numSamples);
-	void noteOn(int32 pitch, ParamValue velocity, float tuning, int32 sampleOffset, int32 noteId) SMTG_OVERRIDE;
-	void noteOff(ParamValue velocity, int32 sampleOffset) SMTG_OVERRIDE;
-	void reset() SMTG_OVERRIDE;
+	// A sub-block is rendered in two steps, so the VoiceProcessor can filter all voices
+	// together in between: the oscillators go to every stride-th value of dry, returns false
+	// when the voice ended, and mixTo adds them with envelope, volume and pan to the outputs.
+	bool renderOscillators(SamplePrecision* dry, int32 stride, int32 numSamples);
+	void mixTo(const SamplePrecision* wet, int32 stride, SamplePrecision* outputBuffers[2], int32 numSamples);
+
+	template <class FilterBank>
+	void loadFilterLane(FilterBank& bank, int32 lane) const;
+	template <class FilterBank>
+	void storeFilterLane(const FilterBank& bank, int32 lane) { bank.getLane(lane, filterState); }
+	void noteOn(int32 pitch, float tuning, int32 noteId);
+	// Starts the attack again from the current level, oscillators and filter go on without a click
+	void retrigger(float tuning, int32 noteId);
+	void noteOff();
+	void reset();
+	void setSampleRate(ParamValue _sampleRate);
+	void setNoteExpressionValue(int32 index, ParamValue value);
+
+	int32 getNoteId() const { return noteId; }
+	bool isReleased() const { return noteOffReceived; }
+
+	// The part this voice plays, set by the VoiceProcessor at note on
+	void setGlobalParameters(GlobalParameterState* parameters) { globalParameters = parameters; }
+	GlobalParameterState* getGlobalParameters() const { return globalParameters; }
+	bool isFiltered() const { return globalParameters->filter.enabled; }
+
+	// For the editor's tuning display, without the global pitch modulation
+	int32 getPitch() const { return pitch; }
+	ParamValue getFrequency() const { return phaseIncrement * pitchRatio * sampleRate; }
+
+	// Playing state in units independent of the sample rate, see VoiceProcessor::Snapshot
+	struct Snapshot
+	{
+		int32 noteId;
+		int32 pitch;
+		double frequency; // tuned, without note expressions, in Hz
+		double elapsed; // since note on, in s
+		double volume; // envelope target
+		double currentVol; // envelope level
+		double rampRate; // envelope multiplier per s
+		bool pastAttack;
+		bool noteOffReceived;
+		double phases[UnisonSpread::kMaxOscillators];
+		double expressionValues[kNumParameters];
+		double noteTuningRatio;
+		double filterState[2];
+	};
+	void getSnapshot(Snapshot& snapshot) const;
+	// Replaces the whole state, the voice must have its parameters already
+	void setSnapshot(const Snapshot& snapshot);
 
 private:
-	inline ParamValue dBToFactor(ParamValue val_dB)
-	{
-		return pow(10, val_dB / 20.0);
-	}
+	void updateExpressionGains();
+
+	// One sample of all unison oscillators, one lane each as in VoiceFilterBank.
+	// gains are those of sinus, square, saw and triangle.
+	template<bool cheapSinus>
+	static double renderUnisonSample(ParamValue* phases, const ParamValue* ratios, int32 numOscillators, ParamValue increment, const ParamValue gains[4]);
 
-	inline constexpr SamplePrecision sgn(SamplePrecision v)
-	{
-		return ( (SamplePrecision(0) < v) - (v < SamplePrecision(0)) );
-	}
-	
 	//inline constexpr SamplePrecision saw(double t, double f)
 	//{
 	//	double temp;
 	//	return modf(t * f, &temp) * 2.0 - 1.0;
 	//}
 
-	ParamValue frequency = 0.0;
+	// Once per sub-block: the VoiceProcessor's scans, the envelope and the filter
+	alignas(64) GlobalParameterState* globalParameters = nullptr;
+	ParamValue currentVol = 0.0;
 	ParamValue volume = 0.0;
-	//ParamValue rampTime = 0.0;
 	ParamValue rampMultiplier = 0.0;
-	//ParamValue sinusRampMultiplier = 0.0;
-	//ParamValue squareRampMultiplier = 0.0;
-	//ParamValue sawRampMultiplier = 0.0;
-	//ParamValue triRampMultiplier = 0.0;
-
-	ParamValue currentVol = 0.0;
-	//ParamValue currentSinusVol = 0.0;
-	//ParamValue currentSquareVol = 0.0;
-	//ParamValue currentSawVol = 0.0;
-	//ParamValue currentTriVol = 0.0;
-
-	//ParamValue currentSinusPhase = 0.0;
-	//ParamValue currentSinusVolume = 0.0;
-	//ParamValue currentSinusFreq = 0.0;
-
+	FilterState<SamplePrecision> filterState;
+	int32 noteId = -1;
 	uint32 n = 0;
 	bool pastAttack = false;
 	bool noteOffReceived = false;
 
+	// Every sample, renderOscillators and mixTo keep them in locals and write them back.
+	// The phases of the unison oscillators follow on the next lines.
+	alignas(64) ParamValue phaseIncrement = 0.0; // per sample, of the tuned frequency
+	ParamValue pitchRatio = 1.0;
+	ParamValue targetPitchRatio = 1.0;
+	ParamValue smoothingCoeff = 1.0;
+	ParamValue expressionGain[2] = { 1.0, 1.0 };
+	ParamValue targetExpressionGain[2] = { 1.0, 1.0 };
+	ParamValue phases[UnisonSpread::kMaxOscillators] = {}; // in [0, 1), one per unison oscillator
+
+	// At note on and off and for note expressions
+	int32 pitch = -1;
+	ParamValue sampleRate = 44100.0;
+	ParamValue noteTuningRatio = 1.0; // from the note on event
+	ParamValue expressionValues[kNumParameters] = {}; // normalized
 };
 
 template<class SamplePrecision>
-bool Voice<SamplePrecision>::process(SamplePrecision* outputBuffers[2], int32 numSamples)
+template<bool cheapSinus>
+double Voice<SamplePrecision>::renderUnisonSample(ParamValue* phases, const ParamValue* ratios, int32 numOscillators, ParamValue increment, const ParamValue gains[4])
+{
+	// Branch free, so the compiler runs several oscillators per instruction
+	ParamValue samples[UnisonSpread::kMaxOscillators];
+	for (int32 k = 0; k < numOscillators; ++k)
+	{
+		const double p = phases[k];
+		const double next = p + increment * ratios[k];
+		phases[k] = next - (double)(int32)next; // phases are positive, truncating is flooring
+
+		const double s = 2.0 * p - 1.0;
+
+		// sinus, a parabola is close enough when the CPU is under pressure
+		const double sinus = cheapSinus ? -4.0 * s * (1.0 - std::fabs(s)) : fastSin2PiPhase(p);
+		const double square = (s > 0.0 ? 1.0 : 0.0) - (s < 0.0 ? 1.0 : 0.0);
+		const double tri = -2.0 * std::fabs(s) + 1.0;
+		samples[k] = gains[0] * sinus + gains[1] * square + gains[2] * s + gains[3] * tri;
+	}
+
+	double sample = 0.0;
+	for (int32 k = 0; k < numOscillators; ++k)
+		sample += samples[k];
+	return sample;
+}
+
+template<class SamplePrecision>
+bool Voice<SamplePrecision>::renderOscillators(SamplePrecision* dry, int32 stride, int32 numSamples)
 {
 	//ParamValue sinusFreq = frequency;
 	//if (currentSinusFreq != sinusFreq)
@@ -131,11 +452,11 @@ bool Voice<SamplePrecision>::process(SamplePrecision* outputBuffers[2], int32 nu
 	//}
 
 	// Update ramptime and volume after initial attack
-	if (!noteOffReceived && !pastAttack && n >= sampleRate * GlobalParameterState::paramToPlain(globalParameters->attack, kAttackId) * 0.001)
+	if (!noteOffReceived && !pastAttack && n >= globalParameters->derived.attackSamples)
 	{
-		volume = globalParameters->sustain * dBToFactor(GlobalParameterState::paramToPlain(globalParameters->volume, kVolumeId));
-		ParamValue rampTime = GlobalParameterState::paramToPlain(globalParameters->decay, kDecayId) * 0.001; // in s
-		rampMultiplier = (log(volume) - log(currentVol)) / (rampTime * sampleRate);
+		volume = globalParameters->sustain;
+		ParamValue rampTime = globalParameters->derived.decayTime;
+		rampMultiplier = (fastLog(volume) - fastLog(currentVol)) / (rampTime * sampleRate);
 		//sinusRampMultiplier = (log(volume * globalParameters->sinusVolume) - log(currentSinusVol)) / (rampTime * sampleRate);
 		//squareRampMultiplier = (log(volume * globalParameters->squareVolume) - log(currentSquareVol)) / (rampTime * sampleRate);
 		//sawRampMultiplier = (log(volume * globalParameters->sawVolume) - log(currentSawVol)) / (rampTime * sampleRate);
@@ -148,57 +469,120 @@ bool Voice<SamplePrecision>::process(SamplePrecision* outputBuffers[2], int32 nu
 	{
 		// TODO adjust volume not per block but per sample
 		//currentVol += ((volume - currentVol) / rampTime) * ((ParamValue)numSamples / sampleRate);
-		currentVol += rampMultiplier * numSamples * currentVol;
+		// A step of a whole sub-block can pass the target, the ramp ends there then
+		const ParamValue nextVol = currentVol + rampMultiplier * numSamples * currentVol;
+		currentVol = (nextVol - volume) * (currentVol - volume) > 0.0 ? nextVol : volume;
 		//currentSinusVol += sinusRampMultiplier * numSamples * currentSinusVol;
 		//currentSquareVol += squareRampMultiplier * numSamples * currentSquareVol;
 		//currentSawVol += sawRampMultiplier * numSamples * currentSawVol;
 		//currentTriVol += triRampMultiplier * numSamples * currentTriVol;
 	}
 
-	if (pastAttack && currentVol < 0.0002)
+	// Also when released before the end of the attack
+	if ((pastAttack || noteOffReceived) && currentVol < 0.0002)
 	{
 		// No volume, return false for voice processor to reset voice
 		return false;
 	}
 
+	const bool cheapSinus = globalParameters->qualityLevel >= kQualityCheapOscillators;
+
+	// The loop only works on locals, so its stores to dry don't force reloads through this
+	// or globalParameters
+	const UnisonSpread& unison = globalParameters->unison;
+	const int32 numOscillators = unison.numOscillators;
+	const ParamValue* const ratios = unison.ratios;
+	const ParamValue unisonGain = unison.gain;
+
+	// Shared and already smoothed, see GlobalParameterState::prepareSubBlock
+	const auto& smoothed = globalParameters->smoothed.values;
+	const ParamValue* const pitchModulation = smoothed[SmoothedParameters::kPitchRatio];
+	const ParamValue* const sinusVolume = smoothed[SmoothedParameters::kSinusVolume];
+	const ParamValue* const squareVolume = smoothed[SmoothedParameters::kSquareVolume];
+	const ParamValue* const sawVolume = smoothed[SmoothedParameters::kSawVolume];
+	const ParamValue* const triVolume = smoothed[SmoothedParameters::kTriVolume];
+
+	ParamValue oscillatorPhases[UnisonSpread::kMaxOscillators];
+	for (int32 k = 0; k < numOscillators; ++k)
+		oscillatorPhases[k] = phases[k];
+	ParamValue ratio = pitchRatio;
+	const ParamValue targetRatio = targetPitchRatio;
+	const ParamValue coeff = smoothingCoeff;
+	const ParamValue baseIncrement = phaseIncrement;
+
 	for (int i = 0; i < numSamples; ++i)
 	{
 		//SamplePrecision val = sin(n / sampleRate * currentSinusFreq * M_PI_MUL_2 + currentSinusPhase);
 
-		double tmp;
-		const double p = modf(n / sampleRate * frequency, &tmp);
-		const double saw = 2.0 * p - 1.0;
-
-		// sinus
-		SamplePrecision sample = 0.25 * globalParameters->sinusVolume * sin(p * M_PI_MUL_2);
+		ratio += (targetRatio - ratio) * coeff;
 
-		// square
-		sample += 0.25 * globalParameters->squareVolume * sgn(saw);
-		
-		// saw
-		sample += 0.25 * globalParameters->sawVolume * saw;
+		// All unison oscillators share one phase increment, scaled by their detune ratio
+		const ParamValue increment = baseIncrement * ratio * pitchModulation[i];
+		const ParamValue gains[4] = { sinusVolume[i], squareVolume[i], sawVolume[i], triVolume[i] };
+		const double sample = cheapSinus
+			? renderUnisonSample<true>(oscillatorPhases, ratios, numOscillators, increment, gains)
+			: renderUnisonSample<false>(oscillatorPhases, ratios, numOscillators, increment, gains);
 
-		// tri
-		sample += 0.25 * globalParameters->triVolume * (-2.0 * abs(saw) + 1.0);
-			
-		outputBuffers[0][i] += currentVol * sample;
-		outputBuffers[1][i] += currentVol * sample;
-
-		++n;
+		dry[i * stride] = (SamplePrecision)(sample * unisonGain);
 
 		//phase += 1.0 / sampleRate * tuningInHz * 2 * M_PI;
 	}
 
+	for (int32 k = 0; k < numOscillators; ++k)
+		phases[k] = oscillatorPhases[k];
+	pitchRatio = ratio;
+	n += numSamples;
+
 	return true;
 }
 
 template<class SamplePrecision>
-void Voice<SamplePrecision>::noteOn(int32 pitch, ParamValue velocity, float tuning, int32 sampleOffset, int32 noteId)
+void Voice<SamplePrecision>::mixTo(const SamplePrecision* wet, int32 stride, SamplePrecision* outputBuffers[2], int32 numSamples)
+{
+	const ParamValue* const smoothedVolume = globalParameters->smoothed.values[SmoothedParameters::kVolume];
+
+	// In locals like in renderOscillators, the outputs would alias them otherwise
+	SamplePrecision* const left = outputBuffers[0];
+	SamplePrecision* const right = outputBuffers[1];
+	ParamValue gainLeft = expressionGain[0];
+	ParamValue gainRight = expressionGain[1];
+	const ParamValue targetLeft = targetExpressionGain[0];
+	const ParamValue targetRight = targetExpressionGain[1];
+	const ParamValue coeff = smoothingCoeff;
+	const ParamValue level = currentVol;
+
+	for (int32 i = 0; i < numSamples; ++i)
+	{
+		gainLeft += (targetLeft - gainLeft) * coeff;
+		gainRight += (targetRight - gainRight) * coeff;
+
+		const SamplePrecision sample = wet[i * stride] * level * smoothedVolume[i];
+		left[i] += gainLeft * sample;
+		right[i] += gainRight * sample;
+	}
+
+	expressionGain[0] = gainLeft;
+	expressionGain[1] = gainRight;
+}
+
+template<class SamplePrecision>
+template <class FilterBank>
+void Voice<SamplePrecision>::loadFilterLane(FilterBank& bank, int32 lane) const
+{
+	// The shared coefficients are only recomputed when the envelope moves the cutoff
+	const FilterSettings& filter = globalParameters->filter;
+	ParamValue g = filter.g;
+	if (filter.envelopeOctaves != 0.0)
+		g = getFilterG(filter.cutoffRatio * fastExp2(filter.envelopeOctaves * currentVol));
+	bank.setLane(lane, filterState, g, filter.k);
+}
+
+template<class SamplePrecision>
+void Voice<SamplePrecision>::noteOn(int32 pitch, float tuning, int32 noteId)
 {
-	volume = GlobalParameterState::paramToPlain(globalParameters->volume, kVolumeId);
-	volume = dBToFactor(volume);
-	ParamValue rampTime = GlobalParameterState::paramToPlain(globalParameters->attack, kAttackId) * 0.001;
-	rampMultiplier = (log(volume) - log(currentVol)) / (rampTime * sampleRate);
+	volume = 1.0; // the volume parameter is applied after the envelope
+	ParamValue rampTime = globalParameters->derived.attackTime;
+	rampMultiplier = (fastLog(volume) - fastLog(currentVol)) / (rampTime * sampleRate);
 	//sinusRampMultiplier = (log(volume * globalParameters->sinusVolume) - log(currentSinusVol)) / (rampTime * sampleRate);
 	//squareRampMultiplier = (log(volume * globalParameters->squareVolume) - log(currentSquareVol)) / (rampTime * sampleRate);
 	//sawRampMultiplier = (log(volume * globalParameters->sawVolume) - log(currentSawVol)) / (rampTime * sampleRate);
@@ -206,29 +590,28 @@ void Voice<SamplePrecision>::noteOn(int32 pitch, ParamValue velocity, float tuni
 
 	// Multiplier idea and calculation from: https://www.musicdsp.org/en/latest/Synthesis/189-fast-exponential-envelope-generator.html
 	
-	frequency = 440.0 * pow(2.0, (pitch - 69.0) / 12.0); // Equal step tuning based on pitch
-
-	if (globalParameters->tuning > 0.25) // Not equal step tuning, frequency needs update
-	{
-		//int32 rootNotePitch = 60 + round(globalParameters->rootNote * 11.0); // 60 = MIDI pitch of Middle C
-		int32 rootNotePitch = globalParameters->rootNote; // 60 = MIDI pitch of Middle C
-		//double rootNoteFreq = 440.0 * pow(2.0, (rootNotePitch - 69) / 12.0); // 69 = MIDI pitch of A = 440 Hz
-		double offsetCents = 0.0;
-
-		if (globalParameters->tuning < 0.5)
-			offsetCents = VoiceStatics::getPythagoreanOffset(pitch, rootNotePitch);
-		else if (globalParameters->tuning < 0.75)
-			offsetCents = VoiceStatics::getWerckmeisterIIIOffset(pitch, rootNotePitch);
-		else
-			offsetCents = VoiceStatics::getMeantoneOffset(pitch, rootNotePitch);
-
-		frequency *= pow(2.0, offsetCents / 1200.0);
-	}
+	// The fixed tunings are looked up, only the custom one depends on the state
+	const int32 tuningIndex = globalParameters->getTuning();
+	const int32 rootNotePitch = globalParameters->rootNote; // 60 = MIDI pitch of Middle C
+	phaseIncrement = globalParameters->resources->getPhaseIncrement(tuningIndex, pitch, rootNotePitch);
+	if (tuningIndex == kCustomTuning)
+		phaseIncrement *= fastExp2(VoiceStatics::getCustomOffset(*globalParameters, pitch, rootNotePitch) / 1200.0);
+
+	// Per note tuning of the event and note expressions start from their defaults
+	noteTuningRatio = fastExp2(tuning / 1200.0);
+	pitchRatio = targetPitchRatio = noteTuningRatio;
+	expressionValues[kVolumeExpression] = 0.25; // 0 dB
+	expressionValues[kPanExpression] = 0.5;
+	expressionValues[kTuningExpression] = 0.5;
+	updateExpressionGains();
+	expressionGain[0] = targetExpressionGain[0];
+	expressionGain[1] = targetExpressionGain[1];
 
 	pastAttack = false;
 	noteOffReceived = false;
 
-	Vst::VoiceBase<kNumParameters, SamplePrecision, 2, GlobalParameterState>::noteOn(pitch, velocity, tuning, sampleOffset, noteId);
+	this->pitch = pitch;
+	this->noteId = noteId;
 }
 
 //template<class SamplePrecision>
@@ -316,14 +699,20 @@ void Voice<SamplePrecision>::noteOn(int32 pitch, ParamValue velocity, float tuni
 //}
 
 template<class SamplePrecision>
-void Voice<SamplePrecision>::noteOff(ParamValue velocity, int32 sampleOffset)
+void Voice<SamplePrecision>::retrigger(float tuning, int32 noteId)
 {
-	Vst::VoiceBase<kNumParameters, SamplePrecision, 2, GlobalParameterState>::noteOff(velocity, sampleOffset);
+	// Without reset, so phases, filter state and currentVol are kept
+	n = 0;
+	noteOn(pitch, tuning, noteId);
+}
 
+template<class SamplePrecision>
+void Voice<SamplePrecision>::noteOff()
+{
 	//volume = -0.05; // This is needed to get currentVol < 0 and trigger an reset
 	volume = 0.0001;
-	ParamValue rampTime = GlobalParameterState::paramToPlain(globalParameters->release, kReleaseId) * 0.001;
-	rampMultiplier = (log(volume) - log(currentVol)) / (rampTime * sampleRate);
+	ParamValue rampTime = globalParameters->derived.releaseTime;
+	rampMultiplier = (fastLog(volume) - fastLog(currentVol)) / (rampTime * sampleRate);
 	//sinusRampMultiplier = (log(volume * globalParameters->sinusVolume) - log(currentSinusVol)) / (rampTime * sampleRate);
 	//squareRampMultiplier = (log(volume * globalParameters->squareVolume) - log(currentSquareVol)) / (rampTime * sampleRate);
 	//sawRampMultiplier = (log(volume * globalParameters->sawVolume) - log(currentSawVol)) / (rampTime * sampleRate);
@@ -332,12 +721,106 @@ void Voice<SamplePrecision>::noteOff(ParamValue velocity, int32 sampleOffset)
 	noteOffReceived = true;
 }
 
+template<class SamplePrecision>
+void Voice<SamplePrecision>::setSampleRate(ParamValue _sampleRate)
+{
+	sampleRate = _sampleRate;
+	smoothingCoeff = 1.0 - exp(-1.0 / (0.005 * sampleRate)); // 5 ms
+}
+
+template<class SamplePrecision>
+void Voice<SamplePrecision>::setNoteExpressionValue(int32 index, ParamValue value)
+{
+	if (index < 0 || index >= kNumParameters)
+		return;
+
+	expressionValues[index] = value;
+
+	switch (index)
+	{
+	case kTuningExpression:
+		// [0, 1] is [-120, 120] semitones
+		targetPitchRatio = noteTuningRatio * fastExp2(20.0 * (value - 0.5));
+		break;
+	case kVolumeExpression:
+	case kPanExpression:
+		updateExpressionGains();
+		break;
+	}
+}
+
+template<class SamplePrecision>
+void Voice<SamplePrecision>::updateExpressionGains()
+{
+	// Volume expression is 20 * log(4 * value) dB, pan keeps the center at full level on both sides
+	const ParamValue gain = 4.0 * expressionValues[kVolumeExpression];
+	targetExpressionGain[0] = gain * std::min(1.0, 2.0 * (1.0 - expressionValues[kPanExpression]));
+	targetExpressionGain[1] = gain * std::min(1.0, 2.0 * expressionValues[kPanExpression]);
+}
+
+template<class SamplePrecision>
+void Voice<SamplePrecision>::getSnapshot(Snapshot& snapshot) const
+{
+	snapshot.noteId = this->noteId;
+	snapshot.pitch = this->pitch;
+	snapshot.frequency = phaseIncrement * sampleRate;
+	snapshot.elapsed = n / sampleRate;
+	snapshot.volume = volume;
+	snapshot.currentVol = currentVol;
+	snapshot.rampRate = rampMultiplier * sampleRate;
+	snapshot.pastAttack = pastAttack;
+	snapshot.noteOffReceived = noteOffReceived;
+	for (int32 k = 0; k < UnisonSpread::kMaxOscillators; ++k)
+		snapshot.phases[k] = phases[k];
+	for (int32 i = 0; i < kNumParameters; ++i)
+		snapshot.expressionValues[i] = expressionValues[i];
+	snapshot.noteTuningRatio = noteTuningRatio;
+	snapshot.filterState[0] = filterState.ic1eq;
+	snapshot.filterState[1] = filterState.ic2eq;
+}
+
+template<class SamplePrecision>
+void Voice<SamplePrecision>::setSnapshot(const Snapshot& snapshot)
+{
+	reset();
+	this->noteId = snapshot.noteId;
+	this->pitch = snapshot.pitch;
+	phaseIncrement = snapshot.frequency / sampleRate;
+	n = (uint32)(snapshot.elapsed * sampleRate + 0.5);
+	volume = snapshot.volume;
+	currentVol = snapshot.currentVol;
+	rampMultiplier = snapshot.rampRate / sampleRate;
+	pastAttack = snapshot.pastAttack;
+	noteOffReceived = snapshot.noteOffReceived;
+	for (int32 k = 0; k < UnisonSpread::kMaxOscillators; ++k)
+		phases[k] = snapshot.phases[k];
+	filterState.ic1eq = (SamplePrecision)snapshot.filterState[0];
+	filterState.ic2eq = (SamplePrecision)snapshot.filterState[1];
+
+	// The expressions are where their smoothing would have arrived
+	noteTuningRatio = snapshot.noteTuningRatio;
+	targetPitchRatio = noteTuningRatio;
+	for (int32 i = 0; i < kNumParameters; ++i)
+		setNoteExpressionValue(i, snapshot.expressionValues[i]);
+	pitchRatio = targetPitchRatio;
+	expressionGain[0] = targetExpressionGain[0];
+	expressionGain[1] = targetExpressionGain[1];
+}
+
 template<class SamplePrecision>
 void Voice<SamplePrecision>::reset()
 {
-	Vst::VoiceBase<kNumParameters, SamplePrecision, 2, GlobalParameterState>::reset();
+	noteId = -1;
 	n = 0;
 	currentVol = 0.0001;
+
+	// Unison oscillators start at spread out phases, so they don't add up to a click
+	for (int32 k = 0; k < UnisonSpread::kMaxOscillators; ++k)
+	{
+		const double golden = k * 0.6180339887498949;
+		phases[k] = golden - floor(golden);
+	}
+	filterState = FilterState<SamplePrecision>();
 	//currentSinusVol = 0.0001;
 	//currentSquareVol = 0.0001;
 	//currentSawVol = 0.0001;
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "../include/denormals.h"
+#include "../include/fastmath.h"
+
+#include <algorithm>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// SVF coefficient g = tan(pi * cutoff / sampleRate), the cutoff is kept below Nyquist
+inline double getFilterG(double cutoffRatio)
+{
+	// tan(x) = sin(x) / cos(x)
+	const double turns = 0.5 * std::min(cutoffRatio, 0.49);
+	return fastSin2Pi(turns) / fastSin2Pi(turns + 0.25);
+}
+
+// Integrator states of one voice's filter, kept by the voice between sub-blocks
+template <class SamplePrecision>
+struct FilterState
+{
+	SamplePrecision ic1eq = 0;
+	SamplePrecision ic2eq = 0;
+};
+
+// Zero delay feedback state variable low pass (Andrew Simper's trapezoidal SVF) for many
+// voices at once. States and coefficients are stored as struct of arrays with one lane per
+// voice, and the samples are interleaved by lane, so the inner loop runs over the voices and
+// the compiler can filter several of them per instruction.
+template <class SamplePrecision, int32 numLanes>
+class VoiceFilterBank
+{
+public:
+	// g from getFilterG, k = 1 / Q
+	void setLane(int32 lane, const FilterState<SamplePrecision>& state, double g, double k)
+	{
+		const double a = 1.0 / (1.0 + g * (g + k));
+		ic1eq[lane] = state.ic1eq;
+		ic2eq[lane] = state.ic2eq;
+		a1[lane] = (SamplePrecision)a;
+		a2[lane] = (SamplePrecision)(g * a);
+		a3[lane] = (SamplePrecision)(g * g * a);
+	}
+
+	// The states of a silent voice decay toward zero, they are flushed before they get denormal
+	void getLane(int32 lane, FilterState<SamplePrecision>& state) const
+	{
+		state.ic1eq = flushTiny(ic1eq[lane]);
+		state.ic2eq = flushTiny(ic2eq[lane]);
+	}
+
+	// Filters samples[i * stride + lane] in place for the first activeLanes lanes
+	void process(SamplePrecision* samples, int32 stride, int32 numSamples, int32 activeLanes)
+	{
+		for (int32 i = 0; i < numSamples; ++i)
+		{
+			SamplePrecision* v0 = samples + i * stride;
+			for (int32 lane = 0; lane < activeLanes; ++lane)
+			{
+				const SamplePrecision v3 = v0[lane] - ic2eq[lane];
+				const SamplePrecision v1 = a1[lane] * ic1eq[lane] + a2[lane] * v3;
+				const SamplePrecision v2 = ic2eq[lane] + a2[lane] * ic1eq[lane] + a3[lane] * v3;
+				ic1eq[lane] = 2 * v1 - ic1eq[lane];
+				ic2eq[lane] = 2 * v2 - ic2eq[lane];
+				v0[lane] = v2;
+			}
+		}
+	}
+
+private:
+	SamplePrecision ic1eq[numLanes];
+	SamplePrecision ic2eq[numLanes];
+	SamplePrecision a1[numLanes];
+	SamplePrecision a2[numLanes];
+	SamplePrecision a3[numLanes];
+};
+
+}
+}
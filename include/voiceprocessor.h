@@ -0,0 +1,589 @@
+#pragma once
+
+#include "../include/voicefilter.h"
+
+#include "pluginterfaces/vst/ivstevents.h"
+
+#include <algorithm>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Maps note ids to voice indices in O(1), open addressing with linear probing.
+// numSlots must be a power of two and well above the number of voices.
+template <int32 numSlots>
+class NoteIdMap
+{
+public:
+	NoteIdMap() { clear(); }
+
+	void clear()
+	{
+		for (int32 i = 0; i < numSlots; ++i)
+			voiceIndices[i] = -1;
+	}
+
+	int32 find(int32 noteId) const
+	{
+		for (int32 slot = home(noteId); voiceIndices[slot] != -1; slot = (slot + 1) & kMask)
+		{
+			if (noteIds[slot] == noteId)
+				return voiceIndices[slot];
+		}
+		return -1;
+	}
+
+	// A note id which is already mapped now points to the new voice
+	void insert(int32 noteId, int32 voiceIndex)
+	{
+		int32 slot = home(noteId);
+		while (voiceIndices[slot] != -1 && noteIds[slot] != noteId)
+			slot = (slot + 1) & kMask;
+		noteIds[slot] = noteId;
+		voiceIndices[slot] = voiceIndex;
+	}
+
+	// Only removes the note id if it still points to this voice
+	void erase(int32 noteId, int32 voiceIndex)
+	{
+		int32 slot = home(noteId);
+		while (voiceIndices[slot] != -1 && noteIds[slot] != noteId)
+			slot = (slot + 1) & kMask;
+		if (voiceIndices[slot] != voiceIndex)
+			return;
+
+		// Shift following entries back, so no lookup stops early at the hole
+		voiceIndices[slot] = -1;
+		for (int32 next = (slot + 1) & kMask; voiceIndices[next] != -1; next = (next + 1) & kMask)
+		{
+			const int32 nextHome = home(noteIds[next]);
+			const bool reachable = slot <= next ? (nextHome > slot && nextHome <= next) : (nextHome > slot || nextHome <= next);
+			if (!reachable)
+			{
+				noteIds[slot] = noteIds[next];
+				voiceIndices[slot] = voiceIndices[next];
+				voiceIndices[next] = -1;
+				slot = next;
+			}
+		}
+	}
+
+private:
+	static constexpr int32 kMask = numSlots - 1;
+	static_assert((numSlots & kMask) == 0, "numSlots must be a power of two");
+
+	static int32 home(int32 noteId) { return (int32)(((uint32)noteId * 2654435761u) >> 16) & kMask; }
+
+	int32 noteIds[numSlots];
+	int32 voiceIndices[numSlots];
+};
+
+// Renders the voices of one plug-in instance. Works like Vst::VoiceProcessorImplementation
+// from the SDK samples, but the polyphony can be capped and the number of samples rendered
+// between two envelope updates can be changed while processing. The events are handed in
+// presorted (see EventBuffer), so the caller can split a block at its own events.
+// GlobalParameterStorage has to provide setupProcessing(sampleRate), prepareSubBlock(numSamples)
+// and kMaxSubBlockSize for the values it shares between the voices, the filter settings,
+// reuseVoices() for repeated notes and getOutputBus(channel, pitch), which is asked of the
+// constructor's storage.
+// Each MIDI channel can play its own GlobalParameterStorage (a part), the voices of all parts
+// come from the same pool and are rendered in the same pass.
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+class VoiceProcessor
+{
+public:
+	VoiceProcessor(Vst::ParamValue sampleRate, GlobalParameterStorage* globalParameters);
+
+	// Renders the samples from startSample to endSample on top of outputs. The events must be
+	// sorted by sample offset and lie within that range.
+	void process(SamplePrecision** outputs, int32 startSample, int32 endSample, const Vst::Event* events, int32 numEvents)
+	{
+		process(&outputs, 1, startSample, endSample, events, numEvents);
+	}
+
+	// Each voice renders straight into the buffers of its output bus, chosen at note on.
+	// Voices of buses beyond numBuses or without buffers (nullptr) play on bus 0.
+	static constexpr int32 kMaxOutputBuses = 8;
+	void process(SamplePrecision** const* busOutputs, int32 numBuses, int32 startSample, int32 endSample, const Vst::Event* events, int32 numEvents);
+
+	// Bit per bus that voices were mixed to since the last call
+	uint32 takeWrittenBuses()
+	{
+		const uint32 buses = writtenBuses;
+		writtenBuses = 0;
+		return buses;
+	}
+
+	int32 getActiveVoices() const { return activeVoices; }
+	int32 getMaxVoices() const { return maxVoices; }
+
+	// Pitch and frequency of the voices not released yet, Note needs pitch and frequency members
+	template <class Note>
+	int32 getSoundingNotes(Note* notes, int32 maxNotes) const
+	{
+		int32 numNotes = 0;
+		for (int32 i = 0; i < maxVoices && numNotes < maxNotes; ++i)
+		{
+			if (voices[i].getNoteId() == -1 || voices[i].isReleased())
+				continue;
+			notes[numNotes].pitch = voices[i].getPitch();
+			notes[numNotes].frequency = (float)voices[i].getFrequency();
+			++numNotes;
+		}
+		return numNotes;
+	}
+
+	void setPolyphonyLimit(int32 limit) { polyphonyLimit = std::min(std::max(limit, int32(1)), maxVoices); }
+	void setRenderBlockSize(int32 size) { renderBlockSize = std::min(std::max(size, int32(1)), GlobalParameterStorage::kMaxSubBlockSize); }
+
+	static constexpr int32 kDefaultRenderBlockSize = 16;
+
+	// Notes starting on channel use parameters from now on, nullptr goes back to the
+	// constructor's. The storage must be set up for processing already.
+	static constexpr int32 kNumMidiChannels = 16;
+	void setChannelParameters(int32 channel, GlobalParameterStorage* parameters);
+
+	// Pedals hold the voices of released keys until they go up. Sustain holds every key released
+	// while it is down, sostenuto only the keys that were down when it was pressed.
+	void setSustain(bool down);
+	void setSostenuto(bool down);
+
+	// Playing state of all voices, so their tails go on after a state is reloaded.
+	// VoiceClass::Snapshot has the state of one voice, its part is restored from the MIDI
+	// channel it was played on. Keys and pedals are up after a reload, so voices which were
+	// still held are released when they are restored.
+	struct Snapshot
+	{
+		struct Slot
+		{
+			typename VoiceClass::Snapshot voice;
+			int32 index; // in voices, the output is summed in that order
+			int32 channel;
+			int32 bus;
+		};
+
+		int32 numVoices;
+		Slot slots[maxVoices]; // oldest first
+	};
+	void getSnapshot(Snapshot& snapshot) const;
+	// Replaces all voices, the parts of the channels must be set and updated already
+	void setSnapshot(const Snapshot& snapshot);
+
+protected:
+	void processEvent(const Vst::Event& e);
+	VoiceClass* findVoice(int32 noteId);
+	int32 findVoiceIndex(int32 noteId) const;
+	int32 findRepeatedVoice(const GlobalParameterStorage* parameters, int32 pitch) const;
+	void releaseVoice(int32 index);
+	void releaseHeldVoices();
+	static int32 getNoteKey(int32 noteId, int16 channel, int16 pitch) { return noteId == -1 ? channel * 128 + pitch : noteId; }
+	int32 getFreeVoice();
+	void freeVoice(int32 index);
+	void updateParts();
+
+	GlobalParameterStorage* globalParameters;
+	GlobalParameterStorage* channelParameters[kNumMidiChannels];
+	GlobalParameterStorage* parts[kNumMidiChannels + maxVoices]; // distinct parts of the channels and voices, prepared once per sub-block
+	int32 numParts = 1;
+	VoiceClass voices[maxVoices];
+
+	// Oscillator output of the active voices in one sub-block, interleaved by voice so the
+	// filter bank works on all of them together
+	SamplePrecision voiceSamples[GlobalParameterStorage::kMaxSubBlockSize * maxVoices];
+	int32 laneVoices[maxVoices]; // voice index of each lane
+	int32 voiceBus[maxVoices] = {};
+	int32 voiceChannel[maxVoices] = {};
+	uint32 writtenBuses = 0;
+	VoiceFilterBank<SamplePrecision, maxVoices> filterBank;
+
+	NoteIdMap<4 * maxVoices> noteIdMap;
+	uint32 voiceAge[maxVoices] = {}; // note on order, used for voice stealing
+
+	bool sustainDown = false;
+	bool sostenutoDown = false;
+	bool sostenutoLatched[maxVoices] = {}; // key was down when sostenuto was pressed
+	bool releasePending[maxVoices] = {}; // key is up, but a pedal holds the voice
+	uint32 ageCounter = 0;
+	int32 activeVoices = 0;
+	int32 polyphonyLimit = maxVoices;
+	int32 renderBlockSize = kDefaultRenderBlockSize;
+};
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::VoiceProcessor(Vst::ParamValue sampleRate, GlobalParameterStorage* _globalParameters)
+: globalParameters(_globalParameters)
+{
+	globalParameters->setupProcessing(sampleRate);
+	for (int32 c = 0; c < kNumMidiChannels; ++c)
+		channelParameters[c] = globalParameters;
+	parts[0] = globalParameters;
+
+	for (int32 i = 0; i < maxVoices; ++i)
+	{
+		voices[i].setSampleRate(sampleRate);
+		voices[i].setGlobalParameters(globalParameters);
+		voices[i].reset();
+	}
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::process(SamplePrecision** const* busOutputs, int32 numBuses, int32 startSample, int32 endSample, const Vst::Event* events, int32 numEvents)
+{
+	// Missing buses fall back to the main one
+	SamplePrecision** outputs[kMaxOutputBuses];
+	int32 busOfBus[kMaxOutputBuses];
+	for (int32 b = 0; b < kMaxOutputBuses; ++b)
+	{
+		const bool valid = b < numBuses && busOutputs[b] != nullptr;
+		outputs[b] = valid ? busOutputs[b] : busOutputs[0];
+		busOfBus[b] = valid ? b : 0;
+	}
+
+	int32 eventIndex = 0;
+	int32 samplesProcessed = startSample;
+	while (samplesProcessed < endSample)
+	{
+		while (eventIndex < numEvents && events[eventIndex].sampleOffset <= samplesProcessed)
+			processEvent(events[eventIndex++]);
+
+		// Render up to the next event, but no more than one render block
+		int32 samplesToProcess = std::min(renderBlockSize, endSample - samplesProcessed);
+		if (eventIndex < numEvents)
+			samplesToProcess = std::min(samplesToProcess, events[eventIndex].sampleOffset - samplesProcessed);
+
+		SamplePrecision* buffers[kMaxOutputBuses][numChannels];
+		for (int32 b = 0; b < kMaxOutputBuses; ++b)
+		{
+			for (int32 c = 0; c < numChannels; ++c)
+				buffers[b][c] = outputs[b][c] + samplesProcessed;
+		}
+
+		for (int32 p = 0; p < numParts; ++p)
+			parts[p]->prepareSubBlock(samplesToProcess);
+
+		// Voices of parts with the filter enabled take the first lanes, the filter bank only
+		// runs over those
+		int32 numLanes = 0;
+		int32 numFilteredLanes = 0;
+		for (int32 pass = 0; pass < 2; ++pass)
+		{
+			for (int32 i = 0; i < maxVoices; ++i)
+			{
+				if (voices[i].getNoteId() == -1 || voices[i].isFiltered() != (pass == 0))
+					continue;
+				if (voices[i].renderOscillators(voiceSamples + numLanes, maxVoices, samplesToProcess))
+				{
+					laneVoices[numLanes++] = i;
+				}
+				else
+				{
+					freeVoice(i);
+					--activeVoices;
+				}
+			}
+			if (pass == 0)
+				numFilteredLanes = numLanes;
+		}
+
+		if (numFilteredLanes > 0)
+		{
+			for (int32 lane = 0; lane < numFilteredLanes; ++lane)
+				voices[laneVoices[lane]].loadFilterLane(filterBank, lane);
+			filterBank.process(voiceSamples, maxVoices, samplesToProcess, numFilteredLanes);
+			for (int32 lane = 0; lane < numFilteredLanes; ++lane)
+				voices[laneVoices[lane]].storeFilterLane(filterBank, lane);
+		}
+
+		for (int32 lane = 0; lane < numLanes; ++lane)
+		{
+			const int32 bus = voiceBus[laneVoices[lane]];
+			voices[laneVoices[lane]].mixTo(voiceSamples + lane, maxVoices, buffers[bus], samplesToProcess);
+			writtenBuses |= 1u << busOfBus[bus];
+		}
+
+		samplesProcessed += samplesToProcess;
+	}
+
+	// Events at or behind the end of the range
+	while (eventIndex < numEvents)
+		processEvent(events[eventIndex++]);
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::setChannelParameters(int32 channel, GlobalParameterStorage* parameters)
+{
+	if (channel < 0 || channel >= kNumMidiChannels)
+		return;
+	channelParameters[channel] = parameters ? parameters : globalParameters;
+	updateParts();
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::updateParts()
+{
+	// Sounding voices keep their part, it stays prepared until they ended
+	numParts = 0;
+	auto addPart = [this](GlobalParameterStorage* part) {
+		if (std::find(parts, parts + numParts, part) == parts + numParts)
+			parts[numParts++] = part;
+	};
+	for (int32 c = 0; c < kNumMidiChannels; ++c)
+		addPart(channelParameters[c]);
+	for (int32 i = 0; i < maxVoices; ++i)
+	{
+		if (voices[i].getNoteId() != -1)
+			addPart(voices[i].getGlobalParameters());
+	}
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::processEvent(const Vst::Event& e)
+{
+	switch (e.type)
+	{
+	case Vst::Event::kNoteOnEvent:
+	{
+		// Without note ids the same pitch can sound on several channels
+		const int32 noteId = getNoteKey(e.noteOn.noteId, e.noteOn.channel, e.noteOn.pitch);
+		if (e.noteOn.velocity == 0.f)
+		{
+			// Note on with zero velocity is a note off
+			const int32 index = findVoiceIndex(noteId);
+			if (index != -1)
+				releaseVoice(index);
+		}
+		else
+		{
+			GlobalParameterStorage* parameters = channelParameters[e.noteOn.channel & (kNumMidiChannels - 1)];
+
+			// A repeated note takes over the voice still sounding its pitch instead of adding one
+			int32 index = parameters->reuseVoices() ? findRepeatedVoice(parameters, e.noteOn.pitch) : -1;
+			if (index != -1)
+			{
+				noteIdMap.erase(voices[index].getNoteId(), index);
+				releasePending[index] = false;
+				voiceAge[index] = ++ageCounter;
+				voices[index].retrigger(e.noteOn.tuning, noteId);
+				noteIdMap.insert(noteId, index);
+				break;
+			}
+
+			index = getFreeVoice();
+			if (index != -1)
+			{
+				const int32 bus = globalParameters->getOutputBus(e.noteOn.channel, e.noteOn.pitch);
+				voiceBus[index] = std::min(std::max(bus, int32(0)), kMaxOutputBuses - 1);
+				voiceChannel[index] = e.noteOn.channel & (kNumMidiChannels - 1);
+				voices[index].setGlobalParameters(parameters);
+				voices[index].noteOn(e.noteOn.pitch, e.noteOn.tuning, noteId);
+				noteIdMap.insert(noteId, index);
+			}
+		}
+		break;
+	}
+	case Vst::Event::kNoteOffEvent:
+	{
+		const int32 noteId = getNoteKey(e.noteOff.noteId, e.noteOff.channel, e.noteOff.pitch);
+		const int32 index = findVoiceIndex(noteId);
+		if (index != -1)
+			releaseVoice(index);
+		break;
+	}
+	case Vst::Event::kNoteExpressionValueEvent:
+	{
+		// Released voices still follow their expressions
+		const int32 index = noteIdMap.find(e.noteExpressionValue.noteId);
+		if (index != -1)
+			voices[index].setNoteExpressionValue(e.noteExpressionValue.typeId, e.noteExpressionValue.value);
+		break;
+	}
+	}
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+VoiceClass* VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::findVoice(int32 noteId)
+{
+	const int32 index = findVoiceIndex(noteId);
+	return index == -1 ? nullptr : &voices[index];
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+int32 VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::findVoiceIndex(int32 noteId) const
+{
+	// Released voices keep their note id until their tail ended, skip them
+	const int32 index = noteIdMap.find(noteId);
+	if (index == -1 || voices[index].isReleased() || releasePending[index])
+		return -1;
+	return index;
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+int32 VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::findRepeatedVoice(const GlobalParameterStorage* parameters, int32 pitch) const
+{
+	// The most recent one, if several voices of the part sound the pitch
+	int32 found = -1;
+	for (int32 i = 0; i < maxVoices; ++i)
+	{
+		if (voices[i].getNoteId() != -1 && voices[i].getPitch() == pitch && voices[i].getGlobalParameters() == parameters
+			&& (found == -1 || voiceAge[i] > voiceAge[found]))
+			found = i;
+	}
+	return found;
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::releaseVoice(int32 index)
+{
+	if (sustainDown || sostenutoLatched[index])
+		releasePending[index] = true;
+	else
+		voices[index].noteOff();
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::releaseHeldVoices()
+{
+	for (int32 i = 0; i < maxVoices; ++i)
+	{
+		if (releasePending[i] && !sustainDown && !sostenutoLatched[i])
+		{
+			releasePending[i] = false;
+			voices[i].noteOff();
+		}
+	}
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::setSustain(bool down)
+{
+	sustainDown = down;
+	if (!down)
+		releaseHeldVoices();
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::setSostenuto(bool down)
+{
+	if (down == sostenutoDown)
+		return;
+	sostenutoDown = down;
+
+	for (int32 i = 0; i < maxVoices; ++i)
+		sostenutoLatched[i] = down && voices[i].getNoteId() != -1 && !voices[i].isReleased() && !releasePending[i];
+	if (!down)
+		releaseHeldVoices();
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::getSnapshot(Snapshot& snapshot) const
+{
+	// Sorted by age, so voice stealing goes on in the same order
+	int32 indices[maxVoices];
+	int32 numVoices = 0;
+	for (int32 i = 0; i < maxVoices; ++i)
+	{
+		if (voices[i].getNoteId() == -1)
+			continue;
+		int32 pos = numVoices++;
+		for (; pos > 0 && voiceAge[indices[pos - 1]] > voiceAge[i]; --pos)
+			indices[pos] = indices[pos - 1];
+		indices[pos] = i;
+	}
+
+	snapshot.numVoices = numVoices;
+	for (int32 s = 0; s < numVoices; ++s)
+	{
+		const int32 i = indices[s];
+		typename Snapshot::Slot& slot = snapshot.slots[s];
+		voices[i].getSnapshot(slot.voice);
+		slot.index = i;
+		slot.channel = voiceChannel[i];
+		slot.bus = voiceBus[i];
+	}
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::setSnapshot(const Snapshot& snapshot)
+{
+	for (int32 i = 0; i < maxVoices; ++i)
+	{
+		if (voices[i].getNoteId() != -1)
+			freeVoice(i);
+	}
+	noteIdMap.clear();
+	activeVoices = 0;
+
+	const int32 numVoices = std::min(std::max(snapshot.numVoices, int32(0)), maxVoices);
+	for (int32 s = 0; s < numVoices; ++s)
+	{
+		const typename Snapshot::Slot& slot = snapshot.slots[s];
+		const int32 index = slot.index;
+		if (slot.voice.noteId == -1 || index < 0 || index >= maxVoices || voices[index].getNoteId() != -1)
+			continue;
+
+		++activeVoices;
+		voiceChannel[index] = slot.channel & (kNumMidiChannels - 1);
+		voiceBus[index] = std::min(std::max(slot.bus, int32(0)), kMaxOutputBuses - 1);
+		voices[index].setGlobalParameters(channelParameters[voiceChannel[index]]);
+		voices[index].setSnapshot(slot.voice);
+		if (!voices[index].isReleased())
+			voices[index].noteOff();
+		releasePending[index] = false;
+		sostenutoLatched[index] = false;
+		voiceAge[index] = ++ageCounter;
+		noteIdMap.insert(slot.voice.noteId, index);
+	}
+	sustainDown = false;
+	sostenutoDown = false;
+	updateParts();
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+int32 VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::getFreeVoice()
+{
+	if (activeVoices < polyphonyLimit)
+	{
+		for (int32 i = 0; i < maxVoices; ++i)
+		{
+			if (voices[i].getNoteId() == -1)
+			{
+				++activeVoices;
+				voiceAge[i] = ++ageCounter;
+				return i;
+			}
+		}
+	}
+
+	// Polyphony limit reached, steal the oldest voice, preferably one that is already released
+	int32 oldest = -1;
+	for (int32 i = 0; i < maxVoices; ++i)
+	{
+		if (voices[i].getNoteId() == -1)
+			continue;
+		if (oldest == -1
+			|| (voices[i].isReleased() && !voices[oldest].isReleased())
+			|| (voices[i].isReleased() == voices[oldest].isReleased() && voiceAge[i] < voiceAge[oldest]))
+			oldest = i;
+	}
+
+	if (oldest == -1)
+		return -1;
+
+	freeVoice(oldest);
+	voiceAge[oldest] = ++ageCounter;
+	return oldest;
+}
+
+template <class SamplePrecision, class VoiceClass, int32 numChannels, int32 maxVoices, class GlobalParameterStorage>
+void VoiceProcessor<SamplePrecision, VoiceClass, numChannels, maxVoices, GlobalParameterStorage>::freeVoice(int32 index)
+{
+	noteIdMap.erase(voices[index].getNoteId(), index);
+	voices[index].reset();
+	sostenutoLatched[index] = false;
+	releasePending[index] = false;
+}
+
+}
+}
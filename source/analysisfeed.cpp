@@ -0,0 +1,50 @@
+
+#include "../include/analysisfeed.h"
+
+#include <map>
+#include <mutex>
+
+#if SMTG_OS_WINDOWS
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Benergy {
+namespace BadTempered {
+
+int64 AnalysisFeed::getProcessId()
+{
+#if SMTG_OS_WINDOWS
+	return (int64)GetCurrentProcessId();
+#else
+	return (int64)getpid();
+#endif
+}
+
+static std::mutex registryMutex;
+static std::map<int64, std::weak_ptr<AnalysisFeed>> registry;
+static int64 nextFeedId = 1;
+
+int64 AnalysisFeed::registerFeed(const std::shared_ptr<AnalysisFeed>& feed)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	// Of processors deleted since
+	for (auto it = registry.begin(); it != registry.end();)
+		it = it->second.expired() ? registry.erase(it) : std::next(it);
+
+	const int64 id = nextFeedId++;
+	registry[id] = feed;
+	return id;
+}
+
+std::shared_ptr<AnalysisFeed> AnalysisFeed::findFeed(int64 id)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	auto it = registry.find(id);
+	return it != registry.end() ? it->second.lock() : nullptr;
+}
+
+}
+}
@@ -0,0 +1,203 @@
+
+#include "../include/analysisviews.h"
+
+#include "vstgui/lib/cdrawcontext.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace VSTGUI;
+
+static const CColor kBackgroundColor(16, 16, 20);
+static const CColor kGridColor(60, 60, 70);
+static const CColor kTraceColor(120, 220, 160);
+static const CColor kNoteColor(240, 190, 90);
+
+static constexpr float kMinLevel = -90.f; // dB at the bottom of the spectrum
+static constexpr float kLevelFallPerFrame = 1.5f; // dB
+
+// In place iterative radix-2 FFT, n must be a power of two
+static void fft(std::complex<float>* data, int32 n)
+{
+	for (int32 i = 1, j = 0; i < n; ++i)
+	{
+		int32 bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(data[i], data[j]);
+	}
+
+	for (int32 length = 2; length <= n; length <<= 1)
+	{
+		const double angle = -2.0 * 3.14159265358979323846 / length;
+		const std::complex<float> step((float)std::cos(angle), (float)std::sin(angle));
+		for (int32 start = 0; start < n; start += length)
+		{
+			std::complex<float> w(1.f, 0.f);
+			for (int32 k = 0; k < length / 2; ++k)
+			{
+				const std::complex<float> even = data[start + k];
+				const std::complex<float> odd = data[start + k + length / 2] * w;
+				data[start + k] = even + odd;
+				data[start + k + length / 2] = even - odd;
+				w *= step;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+void AnalysisView::drawBackground(CDrawContext* context)
+{
+	context->setFillColor(kBackgroundColor);
+	context->drawRect(getViewSize(), kDrawFilled);
+	context->setLineWidth(1);
+}
+
+//------------------------------------------------------------------------
+void OscilloscopeView::draw(CDrawContext* context)
+{
+	drawBackground(context);
+
+	const CRect& size = getViewSize();
+	const CCoord centerY = size.top + size.getHeight() / 2;
+	context->setFrameColor(kGridColor);
+	context->drawLine(CPoint(size.left, centerY), CPoint(size.right, centerY));
+
+	// Show half the frame, starting at the first rising zero crossing of the other half
+	const int32 numShown = AnalysisFrame::kNumSamples / 2;
+	int32 start = 0;
+	for (int32 i = 1; i < AnalysisFrame::kNumSamples - numShown; ++i)
+	{
+		if (frame.samples[i - 1] < 0.f && frame.samples[i] >= 0.f)
+		{
+			start = i;
+			break;
+		}
+	}
+
+	context->setFrameColor(kTraceColor);
+	const CCoord scaleX = size.getWidth() / (numShown - 1);
+	const CCoord scaleY = size.getHeight() / 2;
+	CPoint previous(size.left, centerY - std::min(std::max(frame.samples[start], -1.f), 1.f) * scaleY);
+	for (int32 i = 1; i < numShown; ++i)
+	{
+		const CPoint point(size.left + i * scaleX, centerY - std::min(std::max(frame.samples[start + i], -1.f), 1.f) * scaleY);
+		context->drawLine(previous, point);
+		previous = point;
+	}
+
+	setDirty(false);
+}
+
+//------------------------------------------------------------------------
+SpectrumView::SpectrumView(const CRect& size, const AnalysisFrame& frame)
+: AnalysisView(size, frame)
+{
+	std::fill(levels, levels + kNumBins, kMinLevel);
+}
+
+//------------------------------------------------------------------------
+void SpectrumView::frameChanged()
+{
+	// Hann window, its gain of 0.5 is corrected below
+	std::complex<float> bins[AnalysisFrame::kNumSamples];
+	for (int32 i = 0; i < AnalysisFrame::kNumSamples; ++i)
+	{
+		const float window = 0.5f - 0.5f * (float)std::cos(2.0 * 3.14159265358979323846 * i / AnalysisFrame::kNumSamples);
+		bins[i] = frame.samples[i] * window;
+	}
+	fft(bins, AnalysisFrame::kNumSamples);
+
+	const float normalize = 4.f / AnalysisFrame::kNumSamples; // full scale sine at 0 dB
+	for (int32 k = 0; k < kNumBins; ++k)
+	{
+		const float level = 20.f * std::log10(std::max(std::abs(bins[k]) * normalize, 1e-6f));
+		levels[k] = std::max(std::max(level, levels[k] - kLevelFallPerFrame), kMinLevel);
+	}
+
+	invalid();
+}
+
+//------------------------------------------------------------------------
+void SpectrumView::draw(CDrawContext* context)
+{
+	drawBackground(context);
+
+	const CRect& size = getViewSize();
+	const double minFrequency = 20.0;
+	const double nyquist = std::max(frame.sampleRate / 2, 2 * minFrequency);
+	const double octaves = std::log2(nyquist / minFrequency);
+	auto toX = [&](double frequency) { return size.left + size.getWidth() * std::log2(frequency / minFrequency) / octaves; };
+	auto toY = [&](float level) { return size.top + size.getHeight() * (level / kMinLevel); };
+
+	// Grid lines at 100 Hz, 1 kHz and 10 kHz
+	context->setFrameColor(kGridColor);
+	for (double frequency = 100.0; frequency < nyquist; frequency *= 10.0)
+		context->drawLine(CPoint(toX(frequency), size.top), CPoint(toX(frequency), size.bottom));
+
+	context->setFrameColor(kTraceColor);
+	const double binWidth = frame.sampleRate / AnalysisFrame::kNumSamples;
+	bool started = false;
+	CPoint previous;
+	for (int32 k = 1; k < kNumBins; ++k)
+	{
+		const double frequency = k * binWidth;
+		if (frequency < minFrequency)
+			continue;
+
+		const CPoint point(toX(frequency), toY(levels[k]));
+		if (started)
+			context->drawLine(previous, point);
+		previous = point;
+		started = true;
+	}
+
+	setDirty(false);
+}
+
+//------------------------------------------------------------------------
+void TuningDeviationView::draw(CDrawContext* context)
+{
+	drawBackground(context);
+
+	static const char* const kNoteNames[12] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+	const double kRange = 50.0; // Cents from the center to the top and bottom
+
+	const CRect& size = getViewSize();
+	const CCoord columnWidth = size.getWidth() / 12;
+	const CCoord labelHeight = 14;
+	const CCoord centerY = size.top + (size.getHeight() - labelHeight) / 2;
+	const CCoord scaleY = (size.getHeight() - labelHeight) / 2 / kRange;
+
+	context->setFrameColor(kGridColor);
+	context->drawLine(CPoint(size.left, centerY), CPoint(size.right, centerY));
+	context->setFontColor(kGridColor);
+	for (int32 i = 0; i < 12; ++i)
+		context->drawString(kNoteNames[i], CPoint(size.left + i * columnWidth + 3, size.bottom - 3));
+
+	// Bars from the equal tempered pitch, A4 = 440 Hz
+	context->setFillColor(kNoteColor);
+	for (int32 i = 0; i < frame.numNotes; ++i)
+	{
+		const AnalysisFrame::Note& note = frame.notes[i];
+		if (note.frequency <= 0.f || note.pitch < 0)
+			continue;
+
+		const double cents = 1200.0 * std::log2(note.frequency / 440.0) - 100.0 * (note.pitch - 69);
+		const CCoord barY = centerY - std::min(std::max(cents, -kRange), kRange) * scaleY;
+		const CCoord left = size.left + (note.pitch % 12) * columnWidth + columnWidth / 4;
+		context->drawRect(CRect(left, std::min(barY, centerY), left + columnWidth / 2, std::max(barY, centerY) + 1), kDrawFilled);
+	}
+
+	setDirty(false);
+}
+
+}
+}
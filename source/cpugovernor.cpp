@@ -0,0 +1,66 @@
+
+#include "../include/cpugovernor.h"
+
+namespace Benergy {
+namespace BadTempered {
+
+void CpuGovernor::setup(double _sampleRate, bool _enabled)
+{
+	sampleRate = _sampleRate;
+	enabled = _enabled;
+	reset();
+}
+
+void CpuGovernor::reset()
+{
+	smoothedLoad = 0.0;
+	samplesSinceChange = 0.0;
+	samplesBelowLowLoad = 0.0;
+	qualityLevel = kQualityFull;
+}
+
+void CpuGovernor::beginBlock()
+{
+	if (enabled)
+		blockStart = Clock::now();
+}
+
+bool CpuGovernor::endBlock(int32 numSamples)
+{
+	if (!enabled || numSamples < 1)
+		return false;
+
+	const double elapsed = std::chrono::duration<double>(Clock::now() - blockStart).count(); // in s
+	const double deadline = numSamples / sampleRate; // in s
+	const double load = elapsed / deadline;
+
+	// Rise fast so we react before the dropout, fall slowly to ignore single cheap blocks
+	smoothedLoad += (load > smoothedLoad ? 0.5 : 0.05) * (load - smoothedLoad);
+
+	samplesSinceChange += numSamples;
+	if (smoothedLoad < kLowLoad)
+		samplesBelowLowLoad += numSamples;
+	else
+		samplesBelowLowLoad = 0.0;
+
+	if (smoothedLoad > kHighLoad && qualityLevel < kNumQualityLevels - 1 && samplesSinceChange >= kHoldTime * sampleRate)
+	{
+		++qualityLevel;
+		samplesSinceChange = 0.0;
+		samplesBelowLowLoad = 0.0;
+		return true;
+	}
+
+	if (qualityLevel > kQualityFull && samplesBelowLowLoad >= kRecoveryTime * sampleRate)
+	{
+		--qualityLevel;
+		samplesSinceChange = 0.0;
+		samplesBelowLowLoad = 0.0;
+		return true;
+	}
+
+	return false;
+}
+
+}
+}
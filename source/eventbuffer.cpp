@@ -0,0 +1,63 @@
+
+#include "../include/eventbuffer.h"
+
+#include <algorithm>
+
+namespace Benergy {
+namespace BadTempered {
+
+void EventBuffer::collect(Vst::IEventList* inputEvents, int32 numSamples)
+{
+	numVoiceEvents = 0;
+	numRootNoteEvents = 0;
+	numDroppedEvents = 0;
+
+	const int32 numEvents = inputEvents ? inputEvents->getEventCount() : 0;
+	const int32 lastSample = std::max(numSamples - 1, int32(0));
+
+	Vst::Event e;
+	for (int32 i = 0; i < numEvents; ++i)
+	{
+		if (inputEvents->getEvent(i, e) != kResultOk)
+			continue;
+
+		e.sampleOffset = std::min(std::max(e.sampleOffset, int32(0)), lastSample);
+
+		switch (e.type)
+		{
+		case Vst::Event::kNoteOnEvent:
+			if (e.busIndex == 1)
+			{
+				if (numRootNoteEvents < kMaxRootNoteEvents)
+					insertSorted(rootNoteEvents, numRootNoteEvents, e);
+				else
+					++numDroppedEvents;
+			}
+			// Bass notes are played as well
+			[[fallthrough]];
+		case Vst::Event::kNoteOffEvent:
+		case Vst::Event::kNoteExpressionValueEvent:
+			if (numVoiceEvents < kMaxVoiceEvents)
+				insertSorted(voiceEvents, numVoiceEvents, e);
+			else
+				++numDroppedEvents;
+			break;
+		}
+	}
+}
+
+void EventBuffer::insertSorted(Vst::Event* events, int32& numEvents, const Vst::Event& e)
+{
+	// Hosts mostly send sorted events, so this rarely moves anything
+	int32 i = numEvents;
+	while (i > 0 && events[i - 1].sampleOffset > e.sampleOffset)
+	{
+		events[i] = events[i - 1];
+		--i;
+	}
+	events[i] = e;
+	++numEvents;
+}
+
+}
+}
@@ -0,0 +1,149 @@
+
+#include "../include/modulation.h"
+#include "../include/fastmath.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Benergy {
+namespace BadTempered {
+
+static Vst::ParamValue lfoValue(int32 shape, Vst::ParamValue phase)
+{
+	switch (shape)
+	{
+	case kLfoTriangle:
+		return 4.0 * std::abs(phase - 0.5) - 1.0;
+	case kLfoSaw:
+		return 2.0 * phase - 1.0;
+	case kLfoSquare:
+		return phase < 0.5 ? 1.0 : -1.0;
+	default:
+		return fastSin2Pi(phase);
+	}
+}
+
+void ModulationMatrix::setSampleRate(Vst::ParamValue sampleRate)
+{
+	controlPeriod = controlInterval / sampleRate;
+}
+
+void ModulationMatrix::setControlInterval(int32 samples)
+{
+	const Vst::ParamValue sampleRate = controlPeriod > 0.0 ? controlInterval / controlPeriod : 44100.0;
+	controlInterval = std::min(std::max(samples, int32(1)), kMaxSamples);
+	setSampleRate(sampleRate);
+}
+
+void ModulationMatrix::reset()
+{
+	for (auto& phase : lfoPhases)
+		phase = 0.0;
+	for (int32 d = 0; d < kNumModDestinations; ++d)
+	{
+		current[d] = 0.0;
+		step[d] = 0.0;
+		active[d] = false;
+	}
+	samplesToControlPoint = 0;
+}
+
+void ModulationMatrix::getSnapshot(Snapshot& snapshot) const
+{
+	const Vst::ParamValue sampleRate = controlInterval / controlPeriod;
+	for (int32 l = 0; l < ModulationSettings::kNumLfos; ++l)
+		snapshot.lfoPhases[l] = lfoPhases[l];
+	for (int32 d = 0; d < kNumModDestinations; ++d)
+	{
+		snapshot.current[d] = current[d];
+		snapshot.slope[d] = step[d] * sampleRate;
+		snapshot.active[d] = active[d];
+	}
+	snapshot.toControlPoint = samplesToControlPoint / sampleRate;
+}
+
+void ModulationMatrix::setSnapshot(const Snapshot& snapshot)
+{
+	const Vst::ParamValue sampleRate = controlInterval / controlPeriod;
+	for (int32 l = 0; l < ModulationSettings::kNumLfos; ++l)
+		lfoPhases[l] = snapshot.lfoPhases[l] - std::floor(snapshot.lfoPhases[l]);
+	for (int32 d = 0; d < kNumModDestinations; ++d)
+	{
+		current[d] = snapshot.current[d];
+		step[d] = snapshot.slope[d] / sampleRate;
+		active[d] = snapshot.active[d];
+	}
+	const int32 samples = (int32)(snapshot.toControlPoint * sampleRate + 0.5);
+	samplesToControlPoint = std::min(std::max(samples, int32(0)), controlInterval);
+}
+
+void ModulationMatrix::evaluate(const ModulationSettings& settings, Vst::ParamValue destinations[kNumModDestinations])
+{
+	Vst::ParamValue sources[kNumModSources];
+	sources[kModSourceNone] = 0.0;
+	for (int32 l = 0; l < ModulationSettings::kNumLfos; ++l)
+	{
+		sources[kModSourceLfo1 + l] = lfoValue(settings.lfoShape[l], lfoPhases[l]);
+		const Vst::ParamValue phase = lfoPhases[l] + settings.lfoRate[l] * controlPeriod;
+		lfoPhases[l] = phase - std::floor(phase);
+	}
+
+	for (int32 d = 0; d < kNumModDestinations; ++d)
+		destinations[d] = 0.0;
+	for (const auto& slot : settings.slots)
+	{
+		if (slot.source > kModSourceNone && slot.source < kNumModSources && slot.destination > kModDestinationNone && slot.destination < kNumModDestinations)
+			destinations[slot.destination] += slot.amount * sources[slot.source];
+	}
+}
+
+void ModulationMatrix::process(const ModulationSettings& settings, int32 numSamples)
+{
+	numSamples = std::min(numSamples, kMaxSamples);
+
+	bool routed[kNumModDestinations] = {};
+	for (const auto& slot : settings.slots)
+	{
+		if (slot.source > kModSourceNone && slot.source < kNumModSources && slot.destination > kModDestinationNone && slot.destination < kNumModDestinations && slot.amount != 0.0)
+			routed[slot.destination] = true;
+	}
+
+	int32 i = 0;
+	while (i < numSamples)
+	{
+		if (samplesToControlPoint == 0)
+		{
+			// Ramp from where the last interval ended to the next control point
+			Vst::ParamValue next[kNumModDestinations];
+			evaluate(settings, next);
+			for (int32 d = 0; d < kNumModDestinations; ++d)
+			{
+				if (!active[d] && routed[d])
+					current[d] = next[d]; // newly routed, start at its value
+				step[d] = (next[d] - current[d]) / controlInterval;
+				active[d] = routed[d];
+			}
+			samplesToControlPoint = controlInterval;
+		}
+
+		const int32 end = std::min(numSamples, i + samplesToControlPoint);
+		for (int32 d = kModDestinationNone + 1; d < kNumModDestinations; ++d)
+		{
+			if (!active[d])
+				continue;
+			Vst::ParamValue value = current[d];
+			for (int32 j = i; j < end; ++j)
+			{
+				values[d][j] = value;
+				value += step[d];
+			}
+			current[d] = value;
+		}
+
+		samplesToControlPoint -= end - i;
+		i = end;
+	}
+}
+
+}
+}
@@ -0,0 +1,149 @@
+
+#include "../include/parameters.h"
+#include "../include/plugids.h"
+#include "../include/voice.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Benergy {
+namespace BadTempered {
+
+static constexpr int32 kAutomate = Vst::ParameterInfo::kCanAutomate;
+static constexpr int32 kAutomateList = Vst::ParameterInfo::kCanAutomate | Vst::ParameterInfo::kIsList;
+
+// In the order of the list enums, they are saved by index
+static const Vst::TChar* const kTuningEntries[] = { STR16("Equal Step"), STR16("Pythagorean"), STR16("Werckmeister III"), STR16("Meantone 1/4 comma"), STR16("Custom"), STR16("Kirnberger III"), STR16("Vallotti"), STR16("Just") };
+static const Vst::TChar* const kRootModeEntries[] = { STR16("Last Bass Note"), STR16("Chord Root") };
+static const Vst::TChar* const kQualityEntries[] = { STR16("Full"), STR16("Cheap Oscillators"), STR16("Coarse Envelopes"), STR16("Reduced Polyphony") };
+static const Vst::TChar* const kLfoShapeEntries[] = { STR16("Sine"), STR16("Triangle"), STR16("Saw"), STR16("Square") };
+static const Vst::TChar* const kModSourceEntries[] = { STR16("None"), STR16("LFO 1"), STR16("LFO 2") };
+static const Vst::TChar* const kModDestinationEntries[] = { STR16("None"), STR16("Pitch"), STR16("Volume"), STR16("Sinus Volume"), STR16("Square Volume"), STR16("Sawtooth Volume"), STR16("Triangle Volume") };
+static const Vst::TChar* const kRepeatedNoteEntries[] = { STR16("New Voice"), STR16("Reuse Voice") };
+static const Vst::TChar* const kOutputRoutingEntries[] = { STR16("Main Only"), STR16("By Channel"), STR16("By Key Range") };
+
+template <size_t N>
+static constexpr int32 countOf(const Vst::TChar* const (&)[N]) { return (int32)N; }
+
+static_assert(countOf(kTuningEntries) == kNumTunings, "tuning list");
+static_assert(countOf(kRootModeEntries) == kNumRootModes, "root mode list");
+static_assert(countOf(kQualityEntries) == kNumQualityLevels, "quality list");
+static_assert(countOf(kLfoShapeEntries) == kNumLfoShapes, "LFO shape list");
+static_assert(countOf(kModSourceEntries) == kNumModSources, "modulation source list");
+static_assert(countOf(kModDestinationEntries) == kNumModDestinations, "modulation destination list");
+static_assert(countOf(kRepeatedNoteEntries) == kNumRepeatedNoteModes, "repeated notes list");
+static_assert(countOf(kOutputRoutingEntries) == kNumOutputRoutings, "output routing list");
+
+#define BADTEMPERED_LIST(entries) kScaleList, 0.0, countOf(entries) - 1.0, 0.0, countOf(entries) - 1, 0
+
+const ParameterDescription ParameterTable::kEntries[] =
+{
+	{ kBypassId, STR16("Bypass"), nullptr, nullptr, kScaleNormalized, 0.0, 1.0, 0.0, 1, 0, kAutomate | Vst::ParameterInfo::kIsBypass, nullptr },
+	// Index into the processor's preset bank, like a MIDI program change
+	{ kPresetId, STR16("Preset"), STR16("Prst"), nullptr, kScaleLinear, 0.0, 127.0, 0.0, 127, 0, kAutomate | Vst::ParameterInfo::kIsProgramChange, nullptr },
+
+	{ kVolumeId, STR16("Volume"), STR16("Vol"), STR16("dB"), kScaleLinear, -60.0, 60.0, 0.0, 0, 2, kAutomate, nullptr },
+	{ kTuningId, STR16("Tuning"), STR16("Tun"), nullptr, BADTEMPERED_LIST(kTuningEntries), Vst::ParameterInfo::kIsList, kTuningEntries },
+	{ kRootNoteId, STR16("RootNote"), STR16("Root"), nullptr, kScaleNormalized, 0.0, 1.0, 0.0, 12, 3, Vst::ParameterInfo::kNoFlags, nullptr },
+	{ kRootModeId, STR16("Root Mode"), STR16("RMode"), nullptr, BADTEMPERED_LIST(kRootModeEntries), kAutomateList, kRootModeEntries },
+
+	{ kAttackId, STR16("Attack"), STR16("Atk"), STR16("ms"), kScaleLinear, 3.0, 10000.0, 0.0, 0, 1, kAutomate, nullptr },
+	{ kDecayId, STR16("Decay"), STR16("Dcy"), STR16("ms"), kScaleLinear, 3.0, 10000.0, 0.0, 0, 1, kAutomate, nullptr },
+	{ kSustainId, STR16("Sustain"), STR16("Sus"), nullptr, kScaleNormalized, 0.0, 1.0, 0.0, 0, 2, kAutomate, nullptr },
+	{ kReleaseId, STR16("Release"), STR16("Rls"), STR16("ms"), kScaleLinear, 3.0, 10000.0, 0.0, 0, 1, kAutomate, nullptr },
+
+	{ kSinusVolumeId, STR16("Sinus Volume"), STR16("SinVol"), nullptr, kScaleNormalized, 0.0, 1.0, 1.0, 0, 2, kAutomate, nullptr },
+	{ kSquareVolumeId, STR16("Square Volume"), STR16("SqrVol"), nullptr, kScaleNormalized, 0.0, 1.0, 1.0, 0, 2, kAutomate, nullptr },
+	{ kSawVolumeId, STR16("Sawtooth Volume"), STR16("SawVol"), nullptr, kScaleNormalized, 0.0, 1.0, 1.0, 0, 2, kAutomate, nullptr },
+	{ kTriVolumeId, STR16("Triangle Volume"), STR16("TriVol"), nullptr, kScaleNormalized, 0.0, 1.0, 1.0, 0, 2, kAutomate, nullptr },
+
+	// Reported by the processor's CpuGovernor
+	{ kQualityLevelId, STR16("Quality"), STR16("Qual"), nullptr, BADTEMPERED_LIST(kQualityEntries), Vst::ParameterInfo::kIsList | Vst::ParameterInfo::kIsReadOnly, kQualityEntries },
+
+	{ kUnisonVoicesId, STR16("Unison Voices"), STR16("Uni"), nullptr, kScaleLinear, 1.0, (ParamValue)UnisonSpread::kMaxOscillators, 0.0, UnisonSpread::kMaxOscillators - 1, 0, kAutomate, nullptr },
+	{ kUnisonDetuneId, STR16("Unison Detune"), STR16("Dtn"), STR16("ct"), kScaleLinear, 0.0, 100.0, 0.25, 0, 1, kAutomate, nullptr },
+
+	{ kFilterCutoffId, STR16("Filter Cutoff"), STR16("Cut"), STR16("Hz"), kScaleLogarithmic, 20.0, 20000.0, 1.0, 0, 0, kAutomate, nullptr },
+	{ kFilterResonanceId, STR16("Filter Resonance"), STR16("Res"), nullptr, kScaleNormalized, 0.0, 1.0, 0.0, 0, 2, kAutomate, nullptr },
+	{ kFilterEnvelopeId, STR16("Filter Envelope"), STR16("FEnv"), STR16("%"), kScaleLinear, -100.0, 100.0, 0.5, 0, 0, kAutomate, nullptr },
+
+	{ kLfo1RateId, STR16("LFO 1 Rate"), STR16("Rate"), STR16("Hz"), kScaleLogarithmic, 0.01, 20.0, 0.5, 0, 2, kAutomate, nullptr },
+	{ kLfo1ShapeId, STR16("LFO 1 Shape"), STR16("Shape"), nullptr, BADTEMPERED_LIST(kLfoShapeEntries), kAutomateList, kLfoShapeEntries },
+	{ kLfo2RateId, STR16("LFO 2 Rate"), STR16("Rate"), STR16("Hz"), kScaleLogarithmic, 0.01, 20.0, 0.5, 0, 2, kAutomate, nullptr },
+	{ kLfo2ShapeId, STR16("LFO 2 Shape"), STR16("Shape"), nullptr, BADTEMPERED_LIST(kLfoShapeEntries), kAutomateList, kLfoShapeEntries },
+
+	{ kMod1SourceId, STR16("Mod 1 Source"), STR16("Src"), nullptr, BADTEMPERED_LIST(kModSourceEntries), kAutomateList, kModSourceEntries },
+	{ kMod1DestinationId, STR16("Mod 1 Destination"), STR16("Dst"), nullptr, BADTEMPERED_LIST(kModDestinationEntries), kAutomateList, kModDestinationEntries },
+	{ kMod1AmountId, STR16("Mod 1 Amount"), STR16("Amt"), STR16("%"), kScaleLinear, -100.0, 100.0, 0.5, 0, 0, kAutomate, nullptr },
+	{ kMod2SourceId, STR16("Mod 2 Source"), STR16("Src"), nullptr, BADTEMPERED_LIST(kModSourceEntries), kAutomateList, kModSourceEntries },
+	{ kMod2DestinationId, STR16("Mod 2 Destination"), STR16("Dst"), nullptr, BADTEMPERED_LIST(kModDestinationEntries), kAutomateList, kModDestinationEntries },
+	{ kMod2AmountId, STR16("Mod 2 Amount"), STR16("Amt"), STR16("%"), kScaleLinear, -100.0, 100.0, 0.5, 0, 0, kAutomate, nullptr },
+	{ kMod3SourceId, STR16("Mod 3 Source"), STR16("Src"), nullptr, BADTEMPERED_LIST(kModSourceEntries), kAutomateList, kModSourceEntries },
+	{ kMod3DestinationId, STR16("Mod 3 Destination"), STR16("Dst"), nullptr, BADTEMPERED_LIST(kModDestinationEntries), kAutomateList, kModDestinationEntries },
+	{ kMod3AmountId, STR16("Mod 3 Amount"), STR16("Amt"), STR16("%"), kScaleLinear, -100.0, 100.0, 0.5, 0, 0, kAutomate, nullptr },
+	{ kMod4SourceId, STR16("Mod 4 Source"), STR16("Src"), nullptr, BADTEMPERED_LIST(kModSourceEntries), kAutomateList, kModSourceEntries },
+	{ kMod4DestinationId, STR16("Mod 4 Destination"), STR16("Dst"), nullptr, BADTEMPERED_LIST(kModDestinationEntries), kAutomateList, kModDestinationEntries },
+	{ kMod4AmountId, STR16("Mod 4 Amount"), STR16("Amt"), STR16("%"), kScaleLinear, -100.0, 100.0, 0.5, 0, 0, kAutomate, nullptr },
+
+	// Pedals, CC 64 and 66 of every channel are mapped to them
+	{ kSustainPedalId, STR16("Sustain Pedal"), STR16("Ped"), nullptr, kScaleNormalized, 0.0, 1.0, 0.0, 1, 0, kAutomate, nullptr },
+	{ kSostenutoPedalId, STR16("Sostenuto Pedal"), STR16("Sost"), nullptr, kScaleNormalized, 0.0, 1.0, 0.0, 1, 0, kAutomate, nullptr },
+	{ kRepeatedNotesId, STR16("Repeated Notes"), STR16("Rep"), nullptr, BADTEMPERED_LIST(kRepeatedNoteEntries), kAutomateList, kRepeatedNoteEntries },
+
+	// Stems on the extra output buses
+	{ kOutputRoutingId, STR16("Output Routing"), STR16("Out"), nullptr, BADTEMPERED_LIST(kOutputRoutingEntries), kAutomateList, kOutputRoutingEntries },
+	{ kSplitKey1Id, STR16("Split Key 1"), STR16("Split"), nullptr, kScaleLinear, 0.0, 127.0, 48.0 / 127.0, 127, 0, kAutomate, nullptr },
+	{ kSplitKey2Id, STR16("Split Key 2"), STR16("Split"), nullptr, kScaleLinear, 0.0, 127.0, 60.0 / 127.0, 127, 0, kAutomate, nullptr },
+	{ kSplitKey3Id, STR16("Split Key 3"), STR16("Split"), nullptr, kScaleLinear, 0.0, 127.0, 72.0 / 127.0, 127, 0, kAutomate, nullptr },
+
+	// Held notes and tails go on after the state is reloaded
+	{ kSaveVoicesId, STR16("Save Voices"), STR16("Voices"), nullptr, kScaleNormalized, 0.0, 1.0, 0.0, 1, 0, Vst::ParameterInfo::kNoFlags, nullptr },
+};
+
+#undef BADTEMPERED_LIST
+
+const int32 ParameterTable::kNumEntries = sizeof(kEntries) / sizeof(kEntries[0]);
+
+const ParameterDescription* ParameterTable::find(Vst::ParamID id)
+{
+	const ParameterDescription* end = kEntries + kNumEntries;
+	const ParameterDescription* entry = std::lower_bound(kEntries, end, id,
+		[](const ParameterDescription& e, Vst::ParamID i) { return e.id < i; });
+	return entry != end && entry->id == id ? entry : nullptr;
+}
+
+ParamValue ParameterDescription::toPlain(ParamValue normalized) const
+{
+	switch (scale)
+	{
+	case kScaleLinear:
+		return minPlain + normalized * (maxPlain - minPlain);
+	case kScaleLogarithmic:
+		return minPlain * std::pow(maxPlain / minPlain, normalized);
+	case kScaleList:
+		return (ParamValue)GlobalParameterState::toListIndex(normalized, stepCount + 1);
+	default:
+		return normalized;
+	}
+}
+
+ParamValue ParameterDescription::toNormalized(ParamValue plain) const
+{
+	ParamValue normalized = plain;
+	switch (scale)
+	{
+	case kScaleLinear:
+	case kScaleList:
+		normalized = (plain - minPlain) / (maxPlain - minPlain);
+		break;
+	case kScaleLogarithmic:
+		normalized = std::log(plain / minPlain) / std::log(maxPlain / minPlain);
+		break;
+	default:
+		break;
+	}
+	return std::min(std::max(normalized, 0.0), 1.0);
+}
+
+}
+}
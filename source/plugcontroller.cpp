@@ -35,84 +35,165 @@
 //-----------------------------------------------------------------------------
 
 #include "../include/plugcontroller.h"
+#include "../include/analysisviews.h"
+#include "../include/parameters.h"
 #include "../include/plugids.h"
 #include "../include/voice.h"
 
 #include "base/source/fstreamer.h"
 #include "pluginterfaces/base/ibstream.h"
+#include "pluginterfaces/base/ustring.h"
+#include "pluginterfaces/vst/ivstmidicontrollers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
 
 using namespace VSTGUI;
 
 namespace Benergy {
 namespace BadTempered {
 
+//-----------------------------------------------------------------------------
+// Range parameter with a logarithmic mapping, like ParameterDescription::toPlain for frequencies
+class LogRangeParameter : public Vst::RangeParameter
+{
+public:
+	using RangeParameter::RangeParameter;
+
+	Vst::ParamValue toPlain (Vst::ParamValue valueNormalized) const SMTG_OVERRIDE
+	{
+		return minPlain * std::pow (maxPlain / minPlain, valueNormalized);
+	}
+
+	Vst::ParamValue toNormalized (Vst::ParamValue plainValue) const SMTG_OVERRIDE
+	{
+		const Vst::ParamValue normalized = std::log (plainValue / minPlain) / std::log (maxPlain / minPlain);
+		return std::min (std::max (normalized, 0.0), 1.0);
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Takes the new value at once, so the host reads it back, but leaves notifying the editor's
+// controls to DeferredParameterUpdates::flush
+template <class Base>
+class DeferredParameter : public Base, public DeferredParameterUpdate
+{
+public:
+	template <class... Args>
+	DeferredParameter (DeferredParameterUpdates& updates, Args&&... args)
+	: Base (std::forward<Args> (args)...), updates (updates)
+	{
+	}
+
+	bool setNormalized (Vst::ParamValue normValue) SMTG_OVERRIDE
+	{
+		normValue = std::min (std::max (normValue, 0.0), 1.0);
+		if (normValue == this->valueNormalized)
+			return false;
+		this->valueNormalized = normValue;
+		updates.add (this);
+		return true;
+	}
+
+	void sendUpdate () SMTG_OVERRIDE { this->changed (); }
+
+private:
+	DeferredParameterUpdates& updates;
+};
+
+//-----------------------------------------------------------------------------
+void DeferredParameterUpdates::add (DeferredParameterUpdate* update)
+{
+	if (update->updatePending)
+		return;
+	update->updatePending = true;
+	pending.push_back (update); // reserved for all parameters
+}
+
+//-----------------------------------------------------------------------------
+void DeferredParameterUpdates::flush ()
+{
+	// sendUpdate may set other parameters, those are sent in the same pass
+	for (size_t i = 0; i < pending.size (); ++i)
+	{
+		pending[i]->updatePending = false;
+		pending[i]->sendUpdate ();
+	}
+	pending.clear ();
+}
+
+//-----------------------------------------------------------------------------
+static Vst::Parameter* createParameter (const ParameterDescription& desc, DeferredParameterUpdates& updates)
+{
+	Vst::Parameter* param = nullptr;
+	switch (desc.scale)
+	{
+	case kScaleNormalized:
+		param = new DeferredParameter<Vst::Parameter> (updates, desc.title, desc.id, desc.units, desc.defaultNormalized, desc.stepCount, desc.flags, Vst::kRootUnitId, desc.shortTitle);
+		break;
+	case kScaleLinear:
+		param = new DeferredParameter<Vst::RangeParameter> (updates, desc.title, desc.id, desc.units, desc.minPlain, desc.maxPlain, desc.getDefaultPlain (), desc.stepCount, desc.flags, Vst::kRootUnitId, desc.shortTitle);
+		break;
+	case kScaleLogarithmic:
+		param = new DeferredParameter<LogRangeParameter> (updates, desc.title, desc.id, desc.units, desc.minPlain, desc.maxPlain, desc.getDefaultPlain (), desc.stepCount, desc.flags, Vst::kRootUnitId, desc.shortTitle);
+		break;
+	case kScaleList:
+	{
+		auto listParam = new DeferredParameter<Vst::StringListParameter> (updates, desc.title, desc.id, desc.units, desc.flags, Vst::kRootUnitId, desc.shortTitle);
+		for (int32 i = 0; i <= desc.stepCount; ++i)
+			listParam->appendString (desc.listEntries[i]);
+		param = listParam;
+		break;
+	}
+	}
+
+	// The range constructors normalize the default linearly, also for LogRangeParameter
+	param->getInfo ().defaultNormalizedValue = desc.defaultNormalized;
+	param->setNormalized (desc.defaultNormalized);
+	param->setPrecision (desc.precision);
+	return param;
+}
+
 //-----------------------------------------------------------------------------
 tresult PLUGIN_API PlugController::initialize (FUnknown* context)
 {
 	tresult result = EditController::initialize (context);
 	if (result == kResultTrue)
 	{
-		Vst::Parameter* param;
+		mParameterUpdates.reserve (ParameterTable::kNumEntries + MAX_PARTS - 1);
 
 		//---Create Parameters------------
-		parameters.addParameter (STR16 ("Bypass"), nullptr, 1, 0,
-		                         Vst::ParameterInfo::kCanAutomate | Vst::ParameterInfo::kIsBypass,
-		                         BadTemperedParams::kBypassId);
-
-		auto range = GlobalParameterState::getMinMaxDefaultForParam(kVolumeId);
-		param = new Vst::RangeParameter(L"Volume", kVolumeId, L"dB", std::get<0>(range), std::get<1>(range), std::get<2>(range), 0, Vst::ParameterInfo::kCanAutomate, 0, L"Vol");
-		param->setPrecision(2);
-		parameters.addParameter(param);
-
-		auto listParam = new Vst::StringListParameter(L"Tuning", kTuningId, nullptr, Vst::ParameterInfo::kIsList, 0, L"Tun");
-		listParam->appendString(L"Equal Step");
-		listParam->appendString(L"Pythagorean");
-		listParam->appendString(L"Werckmeister III");
-		listParam->appendString(L"Meantone 1/4 comma");
-		parameters.addParameter(listParam);
-
-		param = new Vst::Parameter(L"RootNote", kRootNoteId, nullptr, 0.0, 12, Vst::ParameterInfo::kNoFlags, 0, L"Root");
-		param->setPrecision(3);
-		parameters.addParameter(param);
-
-		range = GlobalParameterState::getMinMaxDefaultForParam(kAttackId);
-		param = new Vst::RangeParameter(L"Attack", kAttackId, L"ms", std::get<0>(range), std::get<1>(range), std::get<2>(range), 0, Vst::ParameterInfo::kCanAutomate, 0, L"Atk");
-		param->setPrecision(1);
-		parameters.addParameter(param);
-
-		range = GlobalParameterState::getMinMaxDefaultForParam(kDecayId);
-		param = new Vst::RangeParameter(L"Decay", kDecayId, L"ms", std::get<0>(range), std::get<1>(range), std::get<2>(range), 0, Vst::ParameterInfo::kCanAutomate, 0, L"Dcy");
-		param->setPrecision(1);
-		parameters.addParameter(param);
-
-		param = new Vst::Parameter(L"Sustain", kSustainId, nullptr, 1.0, 0, Vst::ParameterInfo::kCanAutomate, 0, L"Sus");
-		param->setPrecision(2);
-		parameters.addParameter(param);
-
-		range = GlobalParameterState::getMinMaxDefaultForParam(kReleaseId);
-		param = new Vst::RangeParameter(L"Release", kReleaseId, L"ms", std::get<0>(range), std::get<1>(range), std::get<2>(range), 0, Vst::ParameterInfo::kCanAutomate, 0, L"Rls");
-		param->setPrecision(1);
-		parameters.addParameter(param);
-
-		param = new Vst::Parameter(L"Sinus Volume", kSinusVolumeId, nullptr, 0.0, 0, Vst::ParameterInfo::kCanAutomate, 0, L"SinVol");
-		param->setPrecision(2);
-		parameters.addParameter(param);
-		
-		param = new Vst::Parameter(L"Square Volume", kSquareVolumeId, nullptr, 0.0, 0, Vst::ParameterInfo::kCanAutomate, 0, L"SqrVol");
-		param->setPrecision(2);
-		parameters.addParameter(param);
-
-		param = new Vst::Parameter(L"Sawtooth Volume", kSawVolumeId, nullptr, 0.0, 0, Vst::ParameterInfo::kCanAutomate, 0, L"SawVol");
-		param->setPrecision(2);
-		parameters.addParameter(param);
-
-		param = new Vst::Parameter(L"Triangle Volume", kTriVolumeId, nullptr, 0.0, 0, Vst::ParameterInfo::kCanAutomate, 0, L"TriVol");
-		param->setPrecision(2);
-		parameters.addParameter(param);
+		for (int32 i = 0; i < ParameterTable::kNumEntries; ++i)
+			parameters.addParameter (createParameter (ParameterTable::kEntries[i], mParameterUpdates));
+
+		// Multitimbral parts, named after the MIDI channel counted from 1 like on the devices
+		const ParameterDescription& preset = *ParameterTable::find (kPresetId);
+		for (int32 channel = 1; channel < MAX_PARTS; ++channel)
+		{
+			char8 ascii[32];
+			snprintf (ascii, sizeof (ascii), "Channel %d Preset", channel + 1);
+			UString128 title (ascii);
+			ParameterDescription part = preset;
+			part.id = kPartPresetId + channel;
+			part.title = title;
+			parameters.addParameter (createParameter (part, mParameterUpdates));
+		}
 	}
 	return kResultTrue;
 }
 
+//------------------------------------------------------------------------
+tresult PLUGIN_API PlugController::terminate ()
+{
+	// The parameters go with the container
+	mParameterUpdates.clear ();
+	return EditController::terminate ();
+}
+
 //------------------------------------------------------------------------
 IPlugView* PLUGIN_API PlugController::createView (const char* name)
 {
@@ -133,32 +214,246 @@ tresult PLUGIN_API PlugController::setComponentState (IBStream* state)
 	if (!state)
 		return kResultFalse;
 
-	IBStreamer streamer (state, kLittleEndian);
-
 	GlobalParameterState gps;
+	gps.setDefaults();
 	tresult res = gps.setState(state);
 
 	if (res == kResultTrue)
 	{
 		setParamNormalized(kBypassId, gps.bypass);
-		setParamNormalized(kVolumeId, gps.volume);
-		setParamNormalized(kTuningId, gps.tuning);
-		setParamNormalized(kRootNoteId, gps.rootNote);
-
-		setParamNormalized(kAttackId, gps.attack);
-		setParamNormalized(kDecayId, gps.decay);
-		setParamNormalized(kSustainId, gps.sustain);
-		setParamNormalized(kReleaseId, gps.release);
-
-		setParamNormalized(kSinusVolumeId, gps.sinusVolume);
-		setParamNormalized(kSquareVolumeId, gps.squareVolume);
-		setParamNormalized(kSawVolumeId, gps.sawVolume);
-		setParamNormalized(kTriVolumeId, gps.triVolume);
+		for (int32 i = 0; i < GlobalParameterState::kNumSavedParameters; ++i)
+		{
+			const auto& param = GlobalParameterState::kSavedParameters[i];
+			setParamNormalized(param.id, gps.getNormalized(param));
+		}
 	}
 
 	return res;
 }
 
+//------------------------------------------------------------------------
+tresult PLUGIN_API PlugController::notify (Vst::IMessage* message)
+{
+	if (!message)
+		return kInvalidArgument;
+
+	// Sent by PlugProcessor::connect with the id of its feed.
+	// A host running the processor in another process gets no meters.
+	if (strcmp (message->getMessageID (), "AnalysisFeed") == 0)
+	{
+		int64 processId = 0;
+		int64 feedId = 0;
+		if (message->getAttributes ()->getInt ("ProcessId", processId) != kResultOk || processId != AnalysisFeed::getProcessId ())
+			return kResultFalse;
+		if (message->getAttributes ()->getInt ("Feed", feedId) != kResultOk)
+			return kResultFalse;
+
+		mAnalysisFeed = AnalysisFeed::findFeed (feedId);
+		return mAnalysisFeed ? kResultOk : kResultFalse;
+	}
+
+	return EditController::notify (message);
+}
+
+//------------------------------------------------------------------------
+VSTGUI::CView* PlugController::createCustomView (const char* name, const VSTGUI::UIAttributes& attributes, const VSTGUI::IUIDescription* description, VSTGUI::VST3Editor* editor)
+{
+	if (!name)
+		return nullptr;
+
+	// Origin and size come from plug.uidesc
+	AnalysisView* view = nullptr;
+	const VSTGUI::CRect size;
+	if (strcmp (name, "Oscilloscope") == 0)
+		view = new OscilloscopeView (size, mAnalysisFrame);
+	else if (strcmp (name, "Spectrum") == 0)
+		view = new SpectrumView (size, mAnalysisFrame);
+	else if (strcmp (name, "TuningDeviation") == 0)
+		view = new TuningDeviationView (size, mAnalysisFrame);
+
+	if (view)
+		mAnalysisViews.push_back (view);
+	return view;
+}
+
+//------------------------------------------------------------------------
+void PlugController::didOpen (VSTGUI::VST3Editor* editor)
+{
+	// Changes made while the editor was closed, its controls have the values already
+	mParameterUpdates.flush ();
+
+	// One update of the controls and meters per frame
+	mFrameTimer = VSTGUI::makeOwned<VSTGUI::CVSTGUITimer> ([this] (VSTGUI::CVSTGUITimer*) {
+		mParameterUpdates.flush ();
+		updateAnalysisViews ();
+	}, 30);
+}
+
+//------------------------------------------------------------------------
+void PlugController::willClose (VSTGUI::VST3Editor* editor)
+{
+	if (mFrameTimer)
+		mFrameTimer->stop ();
+	mFrameTimer = nullptr;
+
+	// The views go with the editor
+	mAnalysisViews.clear ();
+}
+
+//------------------------------------------------------------------------
+void PlugController::updateAnalysisViews ()
+{
+	if (!mAnalysisFeed || !mAnalysisFeed->read (mAnalysisFrame))
+		return;
+
+	for (auto* view : mAnalysisViews)
+		view->frameChanged ();
+}
+
+//------------------------------------------------------------------------
+// Note expressions the voices follow, see Voice::setNoteExpressionValue
+static const struct
+{
+	Vst::NoteExpressionTypeID typeId;
+	const Vst::TChar* title;
+	const Vst::TChar* shortTitle;
+	const Vst::TChar* units;
+	Vst::NoteExpressionValue defaultValue;
+	int32 flags;
+} kNoteExpressions[] =
+{
+	{ Vst::kVolumeTypeID, STR16 ("Volume"), STR16 ("Vol"), STR16 ("dB"), 0.25, Vst::NoteExpressionTypeInfo::kIsAbsolute },
+	{ Vst::kPanTypeID, STR16 ("Pan"), STR16 ("Pan"), STR16 ("%"), 0.5, Vst::NoteExpressionTypeInfo::kIsBipolar | Vst::NoteExpressionTypeInfo::kIsAbsolute },
+	{ Vst::kTuningTypeID, STR16 ("Tuning"), STR16 ("Tun"), STR16 ("Semitones"), 0.5, Vst::NoteExpressionTypeInfo::kIsBipolar },
+};
+
+static const int32 kNumNoteExpressions = sizeof (kNoteExpressions) / sizeof (kNoteExpressions[0]);
+
+//------------------------------------------------------------------------
+int32 PLUGIN_API PlugController::getNoteExpressionCount (int32 busIndex, int16 channel)
+{
+	return kNumNoteExpressions;
+}
+
+//------------------------------------------------------------------------
+tresult PLUGIN_API PlugController::getNoteExpressionInfo (int32 busIndex, int16 channel, int32 noteExpressionIndex, Vst::NoteExpressionTypeInfo& info)
+{
+	if (noteExpressionIndex < 0 || noteExpressionIndex >= kNumNoteExpressions)
+		return kResultFalse;
+
+	const auto& expression = kNoteExpressions[noteExpressionIndex];
+	memset (&info, 0, sizeof (info));
+	info.typeId = expression.typeId;
+	UString (info.title, str16BufferSize (Vst::String128)).assign (expression.title);
+	UString (info.shortTitle, str16BufferSize (Vst::String128)).assign (expression.shortTitle);
+	UString (info.units, str16BufferSize (Vst::String128)).assign (expression.units);
+	info.unitId = -1;
+	info.valueDesc.defaultValue = expression.defaultValue;
+	info.valueDesc.minimum = 0.0;
+	info.valueDesc.maximum = 1.0;
+	info.valueDesc.stepCount = 0;
+	info.associatedParameterId = Vst::kNoParamId;
+	info.flags = expression.flags;
+	return kResultTrue;
+}
+
+//------------------------------------------------------------------------
+tresult PLUGIN_API PlugController::getNoteExpressionStringByValue (int32 busIndex, int16 channel, Vst::NoteExpressionTypeID id, Vst::NoteExpressionValue valueNormalized, Vst::String128 string)
+{
+	double plain;
+	switch (id)
+	{
+	case Vst::kVolumeTypeID:
+		plain = valueNormalized > 0.0 ? 20.0 * log10 (4.0 * valueNormalized) : -120.0;
+		break;
+	case Vst::kPanTypeID:
+		plain = (2.0 * valueNormalized - 1.0) * 100.0;
+		break;
+	case Vst::kTuningTypeID:
+		plain = 240.0 * (valueNormalized - 0.5);
+		break;
+	default:
+		return kResultFalse;
+	}
+
+	UString (string, str16BufferSize (Vst::String128)).printFloat (plain, 2);
+	return kResultTrue;
+}
+
+//------------------------------------------------------------------------
+tresult PLUGIN_API PlugController::getNoteExpressionValueByString (int32 busIndex, int16 channel, Vst::NoteExpressionTypeID id, const Vst::TChar* string, Vst::NoteExpressionValue& valueNormalized)
+{
+	double plain;
+	if (!UString (const_cast<Vst::TChar*> (string), str16BufferSize (Vst::String128)).scanFloat (plain))
+		return kResultFalse;
+
+	switch (id)
+	{
+	case Vst::kVolumeTypeID:
+		valueNormalized = pow (10.0, plain / 20.0) / 4.0;
+		break;
+	case Vst::kPanTypeID:
+		valueNormalized = (plain / 100.0 + 1.0) * 0.5;
+		break;
+	case Vst::kTuningTypeID:
+		valueNormalized = plain / 240.0 + 0.5;
+		break;
+	default:
+		return kResultFalse;
+	}
+
+	valueNormalized = std::min (std::max (valueNormalized, 0.0), 1.0);
+	return kResultTrue;
+}
+
+//------------------------------------------------------------------------
+tresult PLUGIN_API PlugController::getMidiControllerAssignment (int32 busIndex, int16 channel, Vst::CtrlNumber midiControllerNumber, Vst::ParamID& id)
+{
+	if (busIndex != 0 || channel < 0 || channel >= MAX_PARTS)
+		return kResultFalse;
+
+	switch (midiControllerNumber)
+	{
+	case Vst::kCtrlProgramChange:
+		// Selects the preset of the channel's part
+		id = channel == 0 ? (Vst::ParamID)kPresetId : (Vst::ParamID)(kPartPresetId + channel);
+		return kResultTrue;
+	case Vst::kCtrlSustainOnOff:
+		id = kSustainPedalId;
+		return kResultTrue;
+	case Vst::kCtrlSustenutoOnOff:
+		id = kSostenutoPedalId;
+		return kResultTrue;
+	}
+	return kResultFalse;
+}
+
+//------------------------------------------------------------------------
+tresult PlugController::loadPresetBank (const std::string& path)
+{
+	IPtr<Vst::IMessage> message = owned (allocateMessage ());
+	if (!message)
+		return kResultFalse;
+
+	message->setMessageID ("LoadPresetBank");
+	message->getAttributes ()->setBinary ("Path", path.data (), (uint32)path.size ());
+	return sendMessage (message);
+}
+
+//------------------------------------------------------------------------
+tresult PlugController::selectPreset (const std::string& name, int32 channel)
+{
+	IPtr<Vst::IMessage> message = owned (allocateMessage ());
+	if (!message)
+		return kResultFalse;
+
+	message->setMessageID ("SelectPreset");
+	message->getAttributes ()->setBinary ("Name", name.data (), (uint32)name.size ());
+	if (channel > 0)
+		message->getAttributes ()->setInt ("Channel", channel);
+	return sendMessage (message);
+}
+
 //------------------------------------------------------------------------
 } // namespace
 } // namespace Benergy
@@ -35,35 +35,124 @@
 //-----------------------------------------------------------------------------
 
 #include "../include/plugprocessor.h"
+#include "../include/analysisfeed.h"
+#include "../include/denormals.h"
 #include "../include/plugids.h"
 
 #include "base/source/fstreamer.h"
 #include "pluginterfaces/base/ibstream.h"
+#include "pluginterfaces/vst/ivstmessage.h"
 #include "pluginterfaces/vst/ivstparameterchanges.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 namespace Benergy {
 namespace BadTempered {
 
+static const uint32 kPresetBankChunk = makeChunkTag('B', 'A', 'N', 'K'); // UTF-8 path of the preset bank
+static const uint32 kPartChunk = makeChunkTag('P', 'A', 'R', 'T'); // uint32 MIDI channel, parameter chunks of the part
+static const uint32 kVoiceChunk = makeChunkTag('V', 'O', 'I', 'C'); // voice snapshot, see writeVoices
+static const double kVoiceSnapshotInterval = 0.1; // in s, how old the voices getState saves can be
+
+// Field by field, so the chunk doesn't depend on the padding of the snapshot structs
+template <class Snapshot>
+static void writeVoices(StateWriter& writer, const Snapshot& snapshot)
+{
+	writer.write(uint32(snapshot.voices.numVoices));
+	for (int32 s = 0; s < snapshot.voices.numVoices; ++s)
+	{
+		const auto& slot = snapshot.voices.slots[s];
+		writer.write(slot.index);
+		writer.write(slot.channel);
+		writer.write(slot.bus);
+
+		const auto& voice = slot.voice;
+		writer.write(voice.noteId);
+		writer.write(voice.pitch);
+		writer.write(voice.frequency);
+		writer.write(voice.elapsed);
+		writer.write(voice.volume);
+		writer.write(voice.currentVol);
+		writer.write(voice.rampRate);
+		writer.write(uint8(voice.pastAttack));
+		writer.write(uint8(voice.noteOffReceived));
+		writer.write(voice.phases);
+		writer.write(voice.expressionValues);
+		writer.write(voice.noteTuningRatio);
+		writer.write(voice.filterState);
+	}
+
+	for (const auto& part : snapshot.parts)
+	{
+		writer.write(part.smoothed);
+		writer.write(part.modulation.lfoPhases);
+		writer.write(part.modulation.current);
+		writer.write(part.modulation.slope);
+		writer.write(part.modulation.toControlPoint);
+		for (bool active : part.modulation.active)
+			writer.write(uint8(active));
+	}
+}
+
+template <class Snapshot>
+static bool readVoices(StateReader& reader, Snapshot& snapshot)
+{
+	uint32 numVoices;
+	if (!reader.read(numVoices) || numVoices > MAX_VOICES)
+		return false;
+
+	snapshot.voices.numVoices = (int32)numVoices;
+	for (int32 s = 0; s < snapshot.voices.numVoices; ++s)
+	{
+		auto& slot = snapshot.voices.slots[s];
+		auto& voice = slot.voice;
+		uint8 pastAttack, noteOffReceived;
+		if (!reader.read(slot.index) || !reader.read(slot.channel) || !reader.read(slot.bus)
+			|| !reader.read(voice.noteId) || !reader.read(voice.pitch) || !reader.read(voice.frequency) || !reader.read(voice.elapsed)
+			|| !reader.read(voice.volume) || !reader.read(voice.currentVol) || !reader.read(voice.rampRate)
+			|| !reader.read(pastAttack) || !reader.read(noteOffReceived) || !reader.read(voice.phases)
+			|| !reader.read(voice.expressionValues) || !reader.read(voice.noteTuningRatio) || !reader.read(voice.filterState))
+			return false;
+
+		voice.pastAttack = pastAttack != 0;
+		voice.noteOffReceived = noteOffReceived != 0;
+	}
+
+	for (auto& part : snapshot.parts)
+	{
+		if (!reader.read(part.smoothed) || !reader.read(part.modulation.lfoPhases) || !reader.read(part.modulation.current)
+			|| !reader.read(part.modulation.slope) || !reader.read(part.modulation.toControlPoint))
+			return false;
+		for (bool& active : part.modulation.active)
+		{
+			uint8 value;
+			if (!reader.read(value))
+				return false;
+			active = value != 0;
+		}
+	}
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 PlugProcessor::PlugProcessor ()
 {
 	// register its editor class
 	setControllerClass (MyControllerUID);
 
-	mParameterState.volume = 0.0;
-	mParameterState.tuning = 0.0;
-	mParameterState.rootNote = 0.0;
-	mParameterState.bypass = false;
+	mAnalysisFeed = std::make_shared<AnalysisFeed>();
 
-	mParameterState.attack = 0.0;
-	mParameterState.decay = 0.0;
-	mParameterState.sustain = 0.0;
-	mParameterState.release = 0.0;
+	mParameterState.setDefaults();
+	mParameterState.qualityLevel = kQualityFull;
 
-	mParameterState.sinusVolume = 1.0;
-	mParameterState.squareVolume = 1.0;
-	mParameterState.sawVolume = 1.0;
-	mParameterState.triVolume = 1.0;
+	for (int32 c = 0; c < MAX_PARTS; ++c)
+	{
+		mParts[c].setDefaults();
+		mParts[c].qualityLevel = kQualityFull;
+		mPendingPartPresets[c].store(nullptr);
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -80,6 +169,11 @@ tresult PLUGIN_API PlugProcessor::initialize (FUnknown* context)
 	addEventInput(STR16("BassEventInput"), 16, Vst::BusTypes::kAux);
 	addAudioOutput (STR16 ("AudioOutput"), Vst::SpeakerArr::kStereo);
 
+	// Stems, see the Output Routing parameter. Notes routed to an inactive one play on the main output.
+	addAudioOutput (STR16 ("Output 2"), Vst::SpeakerArr::kStereo, Vst::BusTypes::kAux, 0);
+	addAudioOutput (STR16 ("Output 3"), Vst::SpeakerArr::kStereo, Vst::BusTypes::kAux, 0);
+	addAudioOutput (STR16 ("Output 4"), Vst::SpeakerArr::kStereo, Vst::BusTypes::kAux, 0);
+
 	return kResultTrue;
 }
 
@@ -89,13 +183,16 @@ tresult PLUGIN_API PlugProcessor::setBusArrangements (Vst::SpeakerArrangement* i
                                                             Vst::SpeakerArrangement* outputs,
                                                             int32 numOuts)
 {
-	// we only support one in and output bus and these buses must have the same number of channels
+	// All output buses are stereo
 	//if (numIns == 1 && numOuts == 1 && inputs[0] == outputs[0])
-	if (numOuts == 1 && outputs[0] == Vst::SpeakerArr::kStereo)
+	if (numOuts < 1 || numOuts > MAX_OUTPUT_BUSES)
+		return kResultFalse;
+	for (int32 i = 0; i < numOuts; ++i)
 	{
-		return AudioEffect::setBusArrangements (inputs, numIns, outputs, numOuts);
+		if (outputs[i] != Vst::SpeakerArr::kStereo)
+			return kResultFalse;
 	}
-	return kResultFalse;
+	return AudioEffect::setBusArrangements (inputs, numIns, outputs, numOuts);
 }
 
 //-----------------------------------------------------------------------------
@@ -104,6 +201,11 @@ tresult PLUGIN_API PlugProcessor::setupProcessing (Vst::ProcessSetup& setup)
 	// here you get, with setup, information about:
 	// sampleRate, processMode, maximum number of samples per audio block
 	mProcessSetup = setup;
+
+	// Offline rendering has no deadline, always render in full quality there
+	mCpuGovernor.setup(setup.sampleRate, setup.processMode == Vst::kRealtime);
+	mAnalysisFeed->setSampleRate(setup.sampleRate);
+
 	return AudioEffect::setupProcessing (setup);
 }
 
@@ -112,11 +214,44 @@ tresult PLUGIN_API PlugProcessor::setActive (TBool state)
 {
 	if (state) // Initialize
 	{
+		// A state loaded while active, but not processed since
+		if (mLoadedPartSets.update())
+			applyPartSet(mLoadedPartSets.getReadBuffer());
+
 		// Allocate Memory Here
 		// Ex: algo.create ();
 		if (!mVoiceProcessor)
 		{
-			mVoiceProcessor = new Vst::VoiceProcessorImplementation<float, Voice<float>, 2, MAX_VOICES, GlobalParameterState>(mProcessSetup.sampleRate, &mParameterState);
+			mVoiceProcessor = new BadTemperedVoiceProcessor(mProcessSetup.sampleRate, &mParameterState);
+
+			// Every part is ready, so switching a channel to its part needs no allocation
+			for (int32 c = 1; c < MAX_PARTS; ++c)
+			{
+				mParts[c].setupProcessing(mProcessSetup.sampleRate);
+				if (mPartActive[c])
+					mVoiceProcessor->setChannelParameters(c, &mParts[c]);
+			}
+		}
+
+		// Voices of a state loaded while inactive
+		if (mRestoredVoices.update())
+		{
+			setVoiceSnapshot(mRestoredVoices.getReadBuffer());
+			publishVoiceSnapshot();
+		}
+		mVoicesSounded = mVoiceProcessor->getActiveVoices() > 0;
+
+		mCpuGovernor.reset();
+		mRootFollower.reset();
+		applyQualityLevel(mCpuGovernor.getQualityLevel());
+
+		// Buses are only switched while inactive
+		mActiveOutputBuses = 1;
+		Vst::BusList* outputBuses = getBusList(Vst::kAudio, Vst::kOutput);
+		for (int32 b = 1; outputBuses && b < outputBuses->size() && b < MAX_OUTPUT_BUSES; ++b)
+		{
+			if (outputBuses->at(b)->isActive())
+				mActiveOutputBuses |= 1u << b;
 		}
 	}
 	else // Release
@@ -128,6 +263,20 @@ tresult PLUGIN_API PlugProcessor::setActive (TBool state)
 			delete mVoiceProcessor;
 		}
 		mVoiceProcessor = nullptr;
+
+		// Lets the last instance at this sample rate free the shared tables
+		mParameterState.resources.reset();
+		for (auto& part : mParts)
+			part.resources.reset();
+
+		// Nothing processes now, drop all banks but the current one
+		if (mPresetBanks.size() > 1)
+		{
+			mPendingPreset.store(nullptr);
+			for (auto& pending : mPendingPartPresets)
+				pending.store(nullptr);
+			mPresetBanks.erase(mPresetBanks.begin(), mPresetBanks.end() - 1);
+		}
 	}
 	return AudioEffect::setActive (state);
 }
@@ -135,6 +284,14 @@ tresult PLUGIN_API PlugProcessor::setActive (TBool state)
 //-----------------------------------------------------------------------------
 tresult PLUGIN_API PlugProcessor::process (Vst::ProcessData& data)
 {
+	mCpuGovernor.beginBlock();
+	ScopedFlushDenormals flushDenormals; // the host's mode is restored on return
+	mNumPedalChanges = 0;
+
+	// A state loaded since the last block, before the changes and presets of this one
+	if (mLoadedPartSets.update())
+		applyPartSet(mLoadedPartSets.getReadBuffer());
+
 	//--- Read inputs parameter changes-----------
 	if (data.inputParameterChanges)
 	{
@@ -155,38 +312,32 @@ tresult PLUGIN_API PlugProcessor::process (Vst::ProcessData& data)
 					case BadTemperedParams::kBypassId:
 						mParameterState.bypass = (value > 0.5f);
 						break;
-					case BadTemperedParams::kVolumeId:
-						mParameterState.volume = value;
-						break;
-					case BadTemperedParams::kTuningId:
-						mParameterState.tuning = value;
-						break;
-					case BadTemperedParams::kRootNoteId:
-						mParameterState.rootNote = value;
-						break;
-					case BadTemperedParams::kAttackId:
-						mParameterState.attack = value;
+					case BadTemperedParams::kSustainPedalId:
+					case BadTemperedParams::kSostenutoPedalId:
+						for (int32 point = 0; point < numPoints; ++point)
+						{
+							if (paramQueue->getPoint(point, sampleOffset, value) == kResultTrue)
+								addPedalChange(paramQueue->getParameterId(), sampleOffset, value, data.numSamples);
+						}
 						break;
-					case BadTemperedParams::kDecayId:
-						mParameterState.decay = value;
+					case BadTemperedParams::kPresetId:
+						if (PresetBank* bank = mPresetBank.load())
+						{
+							if (const PresetRecord* preset = bank->getPreset((int32)(value * 127.0 + 0.5)))
+								mPendingPreset.store(preset);
+						}
 						break;
-					case BadTemperedParams::kSustainId:
-						mParameterState.sustain = value;
-						break;
-					case BadTemperedParams::kReleaseId:
-						mParameterState.release = value;
-						break;
-					case BadTemperedParams::kSinusVolumeId:
-						mParameterState.sinusVolume = value;
-						break;
-					case BadTemperedParams::kSquareVolumeId:
-						mParameterState.squareVolume = value;
-						break;
-					case BadTemperedParams::kSawVolumeId:
-						mParameterState.sawVolume = value;
-						break;
-					case BadTemperedParams::kTriVolumeId:
-						mParameterState.triVolume = value;
+					default:
+						if (paramQueue->getParameterId() > kPartPresetId && paramQueue->getParameterId() < kPartPresetId + MAX_PARTS)
+						{
+							PresetBank* bank = mPresetBank.load();
+							if (const PresetRecord* preset = bank ? bank->getPreset((int32)(value * 127.0 + 0.5)) : nullptr)
+								mPendingPartPresets[paramQueue->getParameterId() - kPartPresetId].store(preset);
+						}
+						else
+						{
+							mParameterState.setParameter(paramQueue->getParameterId(), value);
+						}
 						break;
 					}
 				}
@@ -194,35 +345,122 @@ tresult PLUGIN_API PlugProcessor::process (Vst::ProcessData& data)
 		}
 	}
 
+	// Switch preset at the block boundary, the record is used in place
+	if (const PresetRecord* preset = mPendingPreset.exchange(nullptr))
+	{
+		PresetBank::applyRecord(*preset, mParameterState);
+		reportParameters(data.outputParameterChanges);
+	}
+
+	for (int32 c = 1; c < MAX_PARTS; ++c)
+	{
+		if (const PresetRecord* preset = mPendingPartPresets[c].exchange(nullptr))
+			applyPartPreset(c, *preset);
+	}
+
+	// Only what changed in this block is derived again
+	mParameterState.updateDerived();
+	for (int32 c = 1; c < MAX_PARTS; ++c)
+	{
+		if (mPartActive[c])
+			mParts[c].updateDerived();
+	}
+
 	//--- Process Audio---------------------
 	//--- ----------------------------------
 	if (data.numOutputs < 1 || data.numSamples < 1)
 	{
-		// nothing to do
+		// nothing to do, but a flush must not leave a pedal down
+		int32 pedalIndex = 0;
+		if (mVoiceProcessor != nullptr)
+			applyPedalChanges(pedalIndex, 0);
 		return kResultOk;
 	}
 
 	if (mVoiceProcessor != nullptr)
 	{
-		// Update tuning
-		Vst::IEventList* inputEvents = data.inputEvents;
-		int32 numEvents = inputEvents ? inputEvents->getEventCount() : 0;
+		// One pass over the host's event list, everything below works on the sorted copy
+		mEventBuffer.collect(data.inputEvents, data.numSamples);
 
-		if (numEvents > 0)
+		if (mRestoredVoices.update())
 		{
-			Vst::Event e;
-			for (int i = 0; i < numEvents; ++i)
-			{
-				inputEvents->getEvent(i, e);
-				if (e.type == Vst::Event::kNoteOnEvent && e.busIndex == 1)
-				{
-					mParameterState.rootNote = e.noteOn.pitch;
-				}
-			}
+			setVoiceSnapshot(mRestoredVoices.getReadBuffer());
+			publishVoiceSnapshot();
+		}
+
+		// The voices render straight into the host's buffers of their bus
+		float** outputs[MAX_OUTPUT_BUSES] = {};
+		const int32 numBuses = std::min(data.numOutputs, int32(MAX_OUTPUT_BUSES));
+		for (int32 b = 0; b < numBuses; ++b)
+		{
+			if (!(mActiveOutputBuses & (1u << b)) || data.outputs[b].numChannels != 2 || !data.outputs[b].channelBuffers32)
+				continue;
+			outputs[b] = (float**)data.outputs[b].channelBuffers32;
+			for (int32 c = 0; c < 2; ++c)
+				memset(outputs[b][c], 0, data.numSamples * sizeof(float));
+		}
+		if (!outputs[0])
+			return kResultOk;
+
+		const Vst::Event* voiceEvents = mEventBuffer.getVoiceEvents();
+		const Vst::Event* rootNoteEvents = mEventBuffer.getRootNoteEvents();
+		const int32 numVoiceEvents = mEventBuffer.getNumVoiceEvents();
+		int32 numRootNoteEvents = mEventBuffer.getNumRootNoteEvents();
+
+		// The follower sees the notes of both buses in every mode, so it knows the held chord
+		// when the mode changes. A chord root applies to the whole block instead of the bass notes.
+		for (int32 i = 0; i < numVoiceEvents; ++i)
+			mRootFollower.processEvent(voiceEvents[i]);
+		if (mParameterState.followChords())
+		{
+			const int32 root = mRootFollower.findRoot();
+			if (root >= 0)
+				setRootNote(root);
+			numRootNoteEvents = 0;
+		}
+		int32 voiceEventIndex = 0;
+		int32 rootNoteIndex = 0;
+		int32 pedalIndex = 0;
+
+		// Main processing, split at the root note and pedal changes so they are sample accurate
+		int32 samplesProcessed = 0;
+		while (samplesProcessed < data.numSamples)
+		{
+			// Before the notes at the same offset, so a bass note is tuned to itself
+			while (rootNoteIndex < numRootNoteEvents && rootNoteEvents[rootNoteIndex].sampleOffset <= samplesProcessed)
+				setRootNote(rootNoteEvents[rootNoteIndex++].noteOn.pitch);
+
+			// Also before the notes, a note off at the offset of sustain down is held
+			applyPedalChanges(pedalIndex, samplesProcessed);
+
+			int32 end = rootNoteIndex < numRootNoteEvents ? rootNoteEvents[rootNoteIndex].sampleOffset : data.numSamples;
+			if (pedalIndex < mNumPedalChanges)
+				end = std::min(end, mPedalChanges[pedalIndex].sampleOffset);
+			const int32 firstEvent = voiceEventIndex;
+			while (voiceEventIndex < numVoiceEvents && (voiceEvents[voiceEventIndex].sampleOffset < end))
+				++voiceEventIndex;
+
+			mVoiceProcessor->process(outputs, numBuses, samplesProcessed, end, voiceEvents + firstEvent, voiceEventIndex - firstEvent);
+			samplesProcessed = end;
 		}
 
-		// Main processing
-		bool res = mVoiceProcessor->process(data);
+		const uint32 writtenBuses = mVoiceProcessor->takeWrittenBuses();
+		for (int32 b = 0; b < data.numOutputs; ++b)
+			data.outputs[b].silenceFlags = (writtenBuses & (1u << b)) ? 0 : 3;
+
+		// Only copies, the editor does the analysis of the main output
+		mAnalysisFeed->write(outputs[0][0], outputs[0][1], data.numSamples, *mVoiceProcessor);
+
+		// For getState, every kVoiceSnapshotInterval while voices sound and once more when
+		// the last one has ended
+		if (mParameterState.savesVoices())
+		{
+			const bool sounding = mVoiceProcessor->getActiveVoices() > 0;
+			mSamplesToVoiceSnapshot -= data.numSamples;
+			if (sounding != mVoicesSounded || (sounding && mSamplesToVoiceSnapshot <= 0))
+				publishVoiceSnapshot();
+			mVoicesSounded = sounding;
+		}
 
 		// Update root note param
 		if (data.outputParameterChanges)
@@ -233,22 +471,360 @@ tresult PLUGIN_API PlugProcessor::process (Vst::ProcessData& data)
 				paramQueue->addPoint(0, mParameterState.rootNote / 128.0, index);
 		}
 
-		return res;
+		// Adapt quality to the measured load, takes effect with the next block
+		if (mCpuGovernor.endBlock(data.numSamples))
+			applyQualityLevel(mCpuGovernor.getQualityLevel());
+
+		// Report quality level for monitoring
+		if (mQualityLevelChanged && data.outputParameterChanges)
+		{
+			int32 index;
+			auto paramQueue = data.outputParameterChanges->addParameterData(BadTemperedParams::kQualityLevelId, index);
+			if (paramQueue)
+			{
+				paramQueue->addPoint(0, (ParamValue)mParameterState.qualityLevel / (kNumQualityLevels - 1), index);
+				mQualityLevelChanged = false;
+			}
+		}
+
+		return kResultOk;
 	}
 
 	return kResultOk;
 }
 
+//------------------------------------------------------------------------
+void PlugProcessor::applyQualityLevel (int32 level)
+{
+	mParameterState.qualityLevel = level;
+	for (auto& part : mParts)
+		part.qualityLevel = level;
+	mQualityLevelChanged = true;
+
+	if (mVoiceProcessor != nullptr)
+	{
+		mVoiceProcessor->setRenderBlockSize(level >= kQualityCoarseEnvelopes ? 64 : BadTemperedVoiceProcessor::kDefaultRenderBlockSize);
+		mVoiceProcessor->setPolyphonyLimit(level >= kQualityReducedPolyphony ? MAX_VOICES / 4 : MAX_VOICES);
+
+		const int32 controlInterval = level >= kQualityCoarseEnvelopes ? 64 : ModulationMatrix::kDefaultControlInterval;
+		mParameterState.modulation.setControlInterval(controlInterval);
+		for (auto& part : mParts)
+			part.modulation.setControlInterval(controlInterval);
+	}
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::applyPartPreset (int32 channel, const PresetRecord& preset)
+{
+	// A part starts from the main parameters, the preset does not cover all of them
+	GlobalParameterState& part = mParts[channel];
+	if (!mPartActive[channel])
+	{
+		part = mParameterState;
+		mPartActive[channel] = true;
+		if (mVoiceProcessor != nullptr)
+			mVoiceProcessor->setChannelParameters(channel, &part);
+	}
+	PresetBank::applyRecord(preset, part);
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::applyPartSet (const PartSet& partSet)
+{
+	// Resources, smoothing and modulation stay as they are, they follow the new values
+	static_cast<ParameterValues&>(mParameterState) = partSet.main;
+	mParameterState.markAllDirty();
+
+	// Channels without a part in the set play the main parameters again
+	for (int32 c = 1; c < MAX_PARTS; ++c)
+	{
+		const bool active = (partSet.activeParts & (1u << c)) != 0;
+		if (active)
+		{
+			static_cast<ParameterValues&>(mParts[c]) = partSet.parts[c];
+			mParts[c].markAllDirty();
+		}
+
+		if (active != mPartActive[c])
+		{
+			mPartActive[c] = active;
+			if (mVoiceProcessor != nullptr)
+				mVoiceProcessor->setChannelParameters(c, active ? &mParts[c] : nullptr);
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::addPedalChange (Vst::ParamID id, int32 sampleOffset, Vst::ParamValue value, int32 numSamples)
+{
+	if (mNumPedalChanges == kMaxPedalChanges)
+		return;
+
+	// Queues are sorted, but there are two of them
+	PedalChange change = { std::max(std::min(sampleOffset, numSamples - 1), int32(0)), id, value >= 0.5 };
+	int32 i = mNumPedalChanges++;
+	for (; i > 0 && mPedalChanges[i - 1].sampleOffset > change.sampleOffset; --i)
+		mPedalChanges[i] = mPedalChanges[i - 1];
+	mPedalChanges[i] = change;
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::applyPedalChanges (int32& index, int32 sampleOffset)
+{
+	for (; index < mNumPedalChanges && mPedalChanges[index].sampleOffset <= sampleOffset; ++index)
+	{
+		const PedalChange& change = mPedalChanges[index];
+		if (change.id == kSustainPedalId)
+			mVoiceProcessor->setSustain(change.down);
+		else
+			mVoiceProcessor->setSostenuto(change.down);
+	}
+}
+
+//------------------------------------------------------------------------
+uint32 PLUGIN_API PlugProcessor::getTailSamples ()
+{
+	// The longest release of the parts, the filter rings out well within it
+	double releaseTime = GlobalParameterState::paramToPlain(mParameterState.release, kReleaseId) * 0.001;
+	for (int32 c = 1; c < MAX_PARTS; ++c)
+	{
+		if (mPartActive[c])
+			releaseTime = std::max(releaseTime, GlobalParameterState::paramToPlain(mParts[c].release, kReleaseId) * 0.001);
+	}
+	return (uint32)std::ceil(releaseTime * mProcessSetup.sampleRate) + 1;
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::setRootNote (int32 pitch)
+{
+	// The bass bus and the chord root set the root note of all parts
+	mParameterState.rootNote = pitch;
+	for (auto& part : mParts)
+		part.rootNote = pitch;
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::reportParameters (Vst::IParameterChanges* outputParameterChanges)
+{
+	if (!outputParameterChanges)
+		return;
+
+	int32 index;
+	for (int32 i = 0; i < GlobalParameterState::kNumSavedParameters; ++i)
+	{
+		const auto& param = GlobalParameterState::kSavedParameters[i];
+		auto paramQueue = outputParameterChanges->addParameterData(param.id, index);
+		if (paramQueue)
+			paramQueue->addPoint(0, mParameterState.getNormalized(param), index);
+	}
+}
+
+//------------------------------------------------------------------------
+bool PlugProcessor::loadPresetBank (const std::string& path)
+{
+	auto bank = std::unique_ptr<PresetBank>(new PresetBank);
+	if (!bank->open(path))
+		return false;
+
+	// The audio thread may still use the old bank, it is kept until setActive(false)
+	mPresetBank.store(bank.get());
+	mPresetBanks.push_back(std::move(bank));
+	return true;
+}
+
+//------------------------------------------------------------------------
+tresult PLUGIN_API PlugProcessor::connect (Vst::IConnectionPoint* other)
+{
+	tresult result = AudioEffect::connect(other);
+	if (result != kResultTrue)
+		return result;
+
+	// Hands the feed to the controller, which shares our process. Both hold a shared_ptr from
+	// then on, so the feed outlives whichever side goes first.
+	IPtr<Vst::IMessage> message = owned(allocateMessage());
+	if (message)
+	{
+		message->setMessageID("AnalysisFeed");
+		message->getAttributes()->setInt("Feed", AnalysisFeed::registerFeed(mAnalysisFeed));
+		message->getAttributes()->setInt("ProcessId", AnalysisFeed::getProcessId());
+		sendMessage(message);
+	}
+	return result;
+}
+
+//------------------------------------------------------------------------
+tresult PLUGIN_API PlugProcessor::notify (Vst::IMessage* message)
+{
+	if (!message)
+		return kInvalidArgument;
+
+	const void* data = nullptr;
+	uint32 size = 0;
+
+	// Sent by PlugController::loadPresetBank
+	if (strcmp(message->getMessageID(), "LoadPresetBank") == 0)
+	{
+		if (message->getAttributes()->getBinary("Path", data, size) != kResultOk)
+			return kResultFalse;
+		return loadPresetBank(std::string(static_cast<const char*>(data), size)) ? kResultOk : kResultFalse;
+	}
+
+	// Sent by PlugController::selectPreset
+	if (strcmp(message->getMessageID(), "SelectPreset") == 0)
+	{
+		PresetBank* bank = mPresetBank.load();
+		if (!bank || message->getAttributes()->getBinary("Name", data, size) != kResultOk)
+			return kResultFalse;
+
+		const PresetRecord* preset = bank->findPreset(std::string(static_cast<const char*>(data), size).c_str());
+		if (!preset)
+			return kResultFalse;
+
+		// Without a channel the main parameters get the preset
+		int64 channel = 0;
+		if (message->getAttributes()->getInt("Channel", channel) == kResultOk && channel > 0 && channel < MAX_PARTS)
+			mPendingPartPresets[channel].store(preset);
+		else
+			mPendingPreset.store(preset);
+		return kResultOk;
+	}
+
+	return AudioEffect::notify(message);
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::readChunk (uint32 tag, StateReader& chunk)
+{
+	if (tag == kPresetBankChunk)
+	{
+		std::string path(chunk.remaining(), '\0');
+		if (chunk.readBytes(&path[0], path.size()))
+		{
+			PresetBank* bank = mPresetBank.load();
+			if (!bank || bank->getPath() != path)
+				loadPresetBank(path);
+		}
+	}
+	else if (tag == kPartChunk)
+	{
+		uint32 channel;
+		if (!chunk.read(channel) || channel == 0 || channel >= MAX_PARTS)
+			return;
+
+		// Parameters missing in the part fall back to their defaults, like in setState
+		PartSet& partSet = mLoadedPartSets.getWriteBuffer();
+		ParameterValues& part = partSet.parts[channel];
+		part.setDefaults();
+		while (!chunk.atEnd())
+		{
+			uint32 partTag, size;
+			StateReader partChunk;
+			if (!chunk.read(partTag) || !chunk.read(size) || !chunk.sub(size, partChunk))
+				return;
+			if (part.readParameterChunk(partTag, partChunk) == kResultFalse)
+				return;
+		}
+		partSet.activeParts |= 1u << channel;
+	}
+	else if (tag == kVoiceChunk)
+	{
+		// The audio thread takes the voices over with its next block, or setActive
+		if (readVoices(chunk, mRestoredVoices.getWriteBuffer()))
+			mRestoredVoices.publish();
+	}
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::writeChunks (StateWriter& writer)
+{
+	if (PresetBank* bank = mPresetBank.load())
+	{
+		writer.beginChunk(kPresetBankChunk);
+		writer.writeBytes(bank->getPath().data(), bank->getPath().size());
+		writer.endChunk();
+	}
+
+	// Parts are nested chunks, beginChunk only keeps track of one size at a time
+	for (uint32 c = 1; c < MAX_PARTS; ++c)
+	{
+		if (mSavedPartSet ? (mSavedPartSet->activeParts & (1u << c)) == 0 : !mPartActive[c])
+			continue;
+
+		StateWriter part;
+		part.write(c);
+		if (mSavedPartSet)
+			mSavedPartSet->parts[c].writeParameterChunks(part);
+		else
+			mParts[c].writeParameterChunks(part);
+
+		writer.beginChunk(kPartChunk);
+		writer.writeBytes(part.data(), part.size());
+		writer.endChunk();
+	}
+
+	// The voices last published by the audio thread, after the parts they play
+	if (mParameterState.savesVoices())
+	{
+		mSavedVoices.update();
+		writer.beginChunk(kVoiceChunk);
+		writeVoices(writer, mSavedVoices.getReadBuffer());
+		writer.endChunk();
+	}
+}
+
 //------------------------------------------------------------------------
 tresult PLUGIN_API PlugProcessor::setState (IBStream* state)
 {
-	return mParameterState.setState(state);
+	// readChunk collects the parts, they are switched to with the main parameters as a whole.
+	// setState starts from the defaults, a broken state is not published.
+	PartSet& partSet = mLoadedPartSets.getWriteBuffer();
+	partSet.activeParts = 0;
+	const tresult result = partSet.main.setState(state, this);
+	if (result != kResultTrue)
+		return result;
+
+	// The audio thread takes them with its next block. Nothing processes while inactive, so
+	// they are taken here then, also over a set published before but never processed.
+	mLoadedPartSets.publish();
+	if (mVoiceProcessor == nullptr && mLoadedPartSets.update())
+		applyPartSet(mLoadedPartSets.getReadBuffer());
+	return result;
 }
 
 //------------------------------------------------------------------------
 tresult PLUGIN_API PlugProcessor::getState (IBStream* state)
 {
-	return mParameterState.getState(state);
+	// A state loaded since the last block is saved as it was loaded
+	mSavedPartSet = mLoadedPartSets.isPending() ? &mLoadedPartSets.getPublishedBuffer() : nullptr;
+	const tresult result = mSavedPartSet ? mSavedPartSet->main.getState(state, this) : mParameterState.getState(state, this);
+	mSavedPartSet = nullptr;
+	return result;
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::publishVoiceSnapshot ()
+{
+	getVoiceSnapshot(mSavedVoices.getWriteBuffer());
+	mSavedVoices.publish();
+	mSamplesToVoiceSnapshot = (int32)(kVoiceSnapshotInterval * mProcessSetup.sampleRate);
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::getVoiceSnapshot (VoiceSnapshot& snapshot) const
+{
+	mVoiceProcessor->getSnapshot(snapshot.voices);
+	mParameterState.getSnapshot(snapshot.parts[0]);
+	for (int32 c = 1; c < MAX_PARTS; ++c)
+		mParts[c].getSnapshot(snapshot.parts[c]);
+}
+
+//------------------------------------------------------------------------
+void PlugProcessor::setVoiceSnapshot (const VoiceSnapshot& snapshot)
+{
+	mParameterState.setSnapshot(snapshot.parts[0]);
+	for (int32 c = 1; c < MAX_PARTS; ++c)
+		mParts[c].setSnapshot(snapshot.parts[c]);
+	mVoiceProcessor->setSnapshot(snapshot.voices);
 }
 
 //------------------------------------------------------------------------
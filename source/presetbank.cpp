@@ -0,0 +1,255 @@
+
+#include "../include/presetbank.h"
+#include "../include/plugids.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if SMTG_OS_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Benergy {
+namespace BadTempered {
+
+static const uint32 kPresetBankMagic = 'B' | ('T' << 8) | ('P' << 16) | ('B' << 24);
+static const uint32 kPresetBankVersion = 2;
+
+#if SMTG_OS_WINDOWS
+static std::wstring toWide(const std::string& utf8)
+{
+	const int length = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, nullptr, 0);
+	std::wstring wide(length > 0 ? length : 1, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, &wide[0], length);
+	return wide;
+}
+#endif
+
+PresetBank::~PresetBank()
+{
+	close();
+}
+
+bool PresetBank::open(const std::string& _path)
+{
+	close();
+
+#if SMTG_OS_WINDOWS
+	HANDLE file = CreateFileW(toWide(_path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	data = static_cast<const uint8*>(view);
+	size = (uint64)fileSize.QuadPart;
+#else
+	int fd = ::open(_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat fileStat;
+	void* view = MAP_FAILED;
+	if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+		view = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	data = static_cast<const uint8*>(view);
+	size = (uint64)fileStat.st_size;
+#endif
+
+	// Validate everything once here, the lookups trust the file afterwards
+	const PresetBankHeader* h = reinterpret_cast<const PresetBankHeader*>(data);
+	const bool valid = size >= sizeof(PresetBankHeader)
+		&& h->magic == kPresetBankMagic
+		&& h->version == kPresetBankVersion
+		&& h->recordSize >= sizeof(PresetRecord) && h->recordSize % 8 == 0
+		&& h->recordsOffset % 8 == 0 && h->indexOffset % 8 == 0
+		&& h->recordsOffset <= size && (uint64)h->numPresets * h->recordSize <= size - h->recordsOffset
+		&& h->indexOffset <= size && (uint64)h->numPresets * sizeof(PresetIndexEntry) <= size - h->indexOffset;
+	bool validRecords = valid;
+	for (uint32 i = 0; validRecords && i < h->numPresets; ++i)
+	{
+		const PresetRecord* record = reinterpret_cast<const PresetRecord*>(data + h->recordsOffset + (uint64)i * h->recordSize);
+		validRecords = record->valuesOffset >= sizeof(PresetRecord) && record->valuesOffset % 8 == 0
+			&& record->valuesOffset <= h->recordSize && (uint64)record->numValues * sizeof(PresetValue) <= h->recordSize - record->valuesOffset;
+	}
+	if (!validRecords)
+	{
+		close();
+		return false;
+	}
+
+	header = h;
+	index = reinterpret_cast<const PresetIndexEntry*>(data + h->indexOffset);
+	path = _path;
+
+	// Touch every page now, so switching presets never page faults on the audio thread
+	volatile uint8 sum = 0;
+	for (uint64 offset = 0; offset < size; offset += 4096)
+		sum += data[offset];
+
+	return true;
+}
+
+void PresetBank::close()
+{
+	if (data)
+	{
+#if SMTG_OS_WINDOWS
+		UnmapViewOfFile(data);
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		mappingHandle = nullptr;
+		fileHandle = nullptr;
+#else
+		munmap(const_cast<uint8*>(data), (size_t)size);
+#endif
+	}
+
+	data = nullptr;
+	size = 0;
+	header = nullptr;
+	index = nullptr;
+	path.clear();
+}
+
+const PresetRecord* PresetBank::getPreset(int32 i) const
+{
+	if (!header || i < 0 || i >= (int32)header->numPresets)
+		return nullptr;
+	return reinterpret_cast<const PresetRecord*>(data + header->recordsOffset + (uint64)i * header->recordSize);
+}
+
+const PresetRecord* PresetBank::findPreset(uint64 nameHash) const
+{
+	if (!header)
+		return nullptr;
+
+	const PresetIndexEntry* end = index + header->numPresets;
+	const PresetIndexEntry* entry = std::lower_bound(index, end, nameHash,
+		[](const PresetIndexEntry& e, uint64 hash) { return e.nameHash < hash; });
+
+	if (entry == end || entry->nameHash != nameHash)
+		return nullptr;
+	return getPreset((int32)entry->recordIndex);
+}
+
+const PresetRecord* PresetBank::findPreset(const char* name) const
+{
+	if (!header || !name)
+		return nullptr;
+
+	const uint64 nameHash = hashName(name);
+	const PresetIndexEntry* end = index + header->numPresets;
+	for (const PresetIndexEntry* entry = std::lower_bound(index, end, nameHash,
+		[](const PresetIndexEntry& e, uint64 hash) { return e.nameHash < hash; });
+		entry != end && entry->nameHash == nameHash; ++entry)
+	{
+		const PresetRecord* record = getPreset((int32)entry->recordIndex);
+		if (record && strncmp(record->name, name, sizeof(record->name)) == 0)
+			return record;
+	}
+	return nullptr;
+}
+
+uint64 PresetBank::hashName(const char* name)
+{
+	// 64 bit FNV-1a
+	uint64 hash = 14695981039346656037ull;
+	for (const char* c = name; *c; ++c)
+	{
+		hash ^= (uint8)*c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+void PresetBank::applyRecord(const PresetRecord& record, GlobalParameterState& state)
+{
+	const bool bypass = state.bypass;
+	state.setDefaults();
+	state.bypass = bypass;
+
+	const PresetValue* values = reinterpret_cast<const PresetValue*>(reinterpret_cast<const uint8*>(&record) + record.valuesOffset);
+	for (uint32 i = 0; i < record.numValues; ++i)
+		state.setSavedValue(values[i].id, values[i].value);
+
+	for (int32 i = 0; i < 12; ++i)
+		state.customTuning[i] = record.customTuning[i];
+}
+
+bool PresetBank::write(const std::string& path, const std::vector<Preset>& presets)
+{
+	PresetBankHeader h;
+	h.magic = kPresetBankMagic;
+	h.version = kPresetBankVersion;
+	h.numPresets = (uint32)presets.size();
+	h.recordSize = (uint32)(sizeof(PresetRecord) + ParameterValues::kNumSavedParameters * sizeof(PresetValue));
+	h.recordsOffset = sizeof(PresetBankHeader);
+	h.indexOffset = h.recordsOffset + (uint64)h.numPresets * h.recordSize;
+
+	std::vector<uint8> records((size_t)h.numPresets * h.recordSize, 0);
+	std::vector<PresetIndexEntry> entries(presets.size());
+	for (size_t i = 0; i < presets.size(); ++i)
+	{
+		PresetRecord& record = *reinterpret_cast<PresetRecord*>(&records[i * h.recordSize]);
+		strncpy(record.name, presets[i].name.c_str(), sizeof(record.name) - 1);
+		record.nameHash = hashName(record.name);
+		for (int32 c = 0; c < 12; ++c)
+			record.customTuning[c] = presets[i].values.customTuning[c];
+
+		record.valuesOffset = sizeof(PresetRecord);
+		record.numValues = (uint32)ParameterValues::kNumSavedParameters;
+		PresetValue* values = reinterpret_cast<PresetValue*>(&records[i * h.recordSize + record.valuesOffset]);
+		for (int32 p = 0; p < ParameterValues::kNumSavedParameters; ++p)
+		{
+			const auto& param = ParameterValues::kSavedParameters[p];
+			values[p].id = param.id;
+			values[p].value = presets[i].values.getSavedValue(param);
+		}
+
+		entries[i].nameHash = record.nameHash;
+		entries[i].recordIndex = (uint32)i;
+		entries[i].reserved = 0;
+	}
+	std::stable_sort(entries.begin(), entries.end(),
+		[](const PresetIndexEntry& a, const PresetIndexEntry& b) { return a.nameHash < b.nameHash; });
+
+#if SMTG_OS_WINDOWS
+	FILE* file = _wfopen(toWide(path).c_str(), L"wb");
+#else
+	FILE* file = fopen(path.c_str(), "wb");
+#endif
+	if (!file)
+		return false;
+
+	bool ok = fwrite(&h, sizeof(h), 1, file) == 1;
+	if (ok && !presets.empty())
+		ok = fwrite(records.data(), 1, records.size(), file) == records.size()
+			&& fwrite(entries.data(), sizeof(PresetIndexEntry), entries.size(), file) == entries.size();
+
+	return fclose(file) == 0 && ok;
+}
+
+}
+}
@@ -0,0 +1,99 @@
+
+#include "../include/rootfollower.h"
+
+namespace Benergy {
+namespace BadTempered {
+
+static uint32 rotatePitchClasses(uint32 classes, int32 steps)
+{
+	return ((classes << steps) | (classes >> (12 - steps))) & 0xFFF;
+}
+
+// Best roots for every set of pitch classes, bit per pitch class. Generated by the build from
+// the chord templates in tools/chordtablebuilder.cpp, so it is read-only data.
+static const uint16 kChordRoots[4096] = {
+#include "chordroots.inc"
+};
+
+//------------------------------------------------------------------------
+int32 NoteSet::lowest() const
+{
+	for (int32 word = 0; word < 2; ++word)
+	{
+		if (!bits[word])
+			continue;
+		int32 pitch = word * 64;
+		for (uint64 remaining = bits[word]; !(remaining & 1); remaining >>= 1)
+			++pitch;
+		return pitch;
+	}
+	return -1;
+}
+
+//------------------------------------------------------------------------
+uint32 NoteSet::getPitchClasses() const
+{
+	// 64 is 4 mod 12, fold each word in steps of 12, then the high word 4 classes up
+	uint32 classes[2] = {};
+	for (int32 word = 0; word < 2; ++word)
+	{
+		for (uint64 remaining = bits[word]; remaining; remaining >>= 12)
+			classes[word] |= (uint32)(remaining & 0xFFF);
+	}
+	return classes[0] | (classes[1] ? rotatePitchClasses(classes[1], 4) : 0);
+}
+
+//------------------------------------------------------------------------
+void RootNoteFollower::reset()
+{
+	bassNotes.clear();
+	mainNotes.clear();
+}
+
+//------------------------------------------------------------------------
+void RootNoteFollower::processEvent(const Vst::Event& e)
+{
+	NoteSet& notes = e.busIndex == 1 ? bassNotes : mainNotes;
+	switch (e.type)
+	{
+	case Vst::Event::kNoteOnEvent:
+		if (e.noteOn.pitch < 0 || e.noteOn.pitch > 127)
+			break;
+		if (e.noteOn.velocity > 0.f)
+			notes.add(e.noteOn.pitch);
+		else
+			notes.remove(e.noteOn.pitch);
+		break;
+	case Vst::Event::kNoteOffEvent:
+		if (e.noteOff.pitch >= 0 && e.noteOff.pitch <= 127)
+			notes.remove(e.noteOff.pitch);
+		break;
+	}
+}
+
+//------------------------------------------------------------------------
+int32 RootNoteFollower::findRoot() const
+{
+	NoteSet all;
+	all.bits[0] = bassNotes.bits[0] | mainNotes.bits[0];
+	all.bits[1] = bassNotes.bits[1] | mainNotes.bits[1];
+	if (all.empty())
+		return -1;
+
+	const uint32 roots = kChordRoots[all.getPitchClasses()];
+
+	// The bass note settles ambiguous chords like C6 / Am7 or diminished 7ths
+	const int32 bass = bassNotes.empty() ? all.lowest() : bassNotes.lowest();
+	if (roots & (1 << (bass % 12)))
+		return bass;
+
+	for (int32 pitch = all.lowest(); pitch < 128; ++pitch)
+	{
+		if (all.contains(pitch) && (roots & (1 << (pitch % 12))))
+			return pitch;
+	}
+	return bass;
+}
+
+}
+}
@@ -0,0 +1,53 @@
+
+#include "../include/sharedresources.h"
+#include "../include/fastmath.h"
+#include "../include/voice.h"
+
+#include <map>
+#include <mutex>
+
+namespace Benergy {
+namespace BadTempered {
+
+std::shared_ptr<const SampleRateResources> SampleRateResources::acquire(Vst::ParamValue sampleRate)
+{
+	static std::mutex mutex;
+	static std::map<Vst::ParamValue, std::weak_ptr<const SampleRateResources>> cache;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto& entry = cache[sampleRate];
+	std::shared_ptr<const SampleRateResources> resources = entry.lock();
+	if (!resources)
+	{
+		resources = std::make_shared<const SampleRateResources>(sampleRate);
+		entry = resources;
+	}
+
+	// Forget sample rates nobody uses anymore
+	for (auto it = cache.begin(); it != cache.end();)
+		it = it->second.expired() ? cache.erase(it) : std::next(it);
+
+	return resources;
+}
+
+SampleRateResources::SampleRateResources(Vst::ParamValue _sampleRate)
+: sampleRate(_sampleRate)
+{
+	phaseIncrements.resize(kNumTunings * 12 * 128);
+	for (int32 pitch = 0; pitch < 128; ++pitch)
+	{
+		const Vst::ParamValue equalStep = 440.0 * fastExp2((pitch - 69.0) / 12.0) / sampleRate;
+		for (int32 tuning = 0; tuning < kNumTunings; ++tuning)
+		{
+			for (int32 root = 0; root < 12; ++root)
+			{
+				const double offsetCents = VoiceStatics::getOffset(tuning, pitch, root);
+				phaseIncrements[((tuning * 12 + root) << 7) + pitch] = offsetCents != 0.0 ? equalStep * fastExp2(offsetCents / 1200.0) : equalStep;
+			}
+		}
+	}
+}
+
+}
+}
@@ -1,178 +1,635 @@
 
 #include "../include/voice.h"
+#include "../include/parameters.h"
 #include "../include/plugids.h"
+#include "../include/statechunks.h"
 
-#include "base/source/fstreamer.h"
-
-#include <tuple>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 namespace Benergy {
 namespace BadTempered {
 
-static uint64 currentParameterStateVersion = 0;
+// State layout (little endian, all supported platforms are):
+//   uint32 magic, uint32 version
+//   chunks of: uint32 tag, uint32 size in bytes, payload
+// Unknown chunks and unknown parameter ids are skipped, so newer states load in older versions
+// and missing parameters fall back to their defaults.
+// States written before version 1 start with a uint64 0 and are a fixed sequence of fields.
+static const uint32 kStateMagic = 'B' | ('T' << 8) | ('S' << 16) | ('T' << 24);
+static const uint32 currentParameterStateVersion = 1;
+
+static const uint32 kParametersChunk = makeChunkTag('P', 'A', 'R', 'M'); // pairs of uint32 param id, double value
+static const uint32 kCustomTuningChunk = makeChunkTag('T', 'U', 'N', 'E'); // uint32 count, doubles in Cents
 
-tresult GlobalParameterState::setState(IBStream* stream)
+// Parameters saved in the parameters chunk. Lists are saved by index and not normalized,
+// so they can grow without breaking existing states.
+const ParameterValues::SavedParameter ParameterValues::kSavedParameters[] =
 {
-	if (!stream)
-		return kResultFalse;
+	{ kVolumeId, &ParameterValues::volume, 0 },
+	{ kTuningId, &ParameterValues::tuning, kNumTunings },
+	{ kRootNoteId, &ParameterValues::rootNote, 0 },
+	{ kRootModeId, &ParameterValues::rootMode, kNumRootModes },
 
-	IBStreamer s (stream, kLittleEndian);
-	uint64 version = 0;
+	{ kAttackId, &ParameterValues::attack, 0 },
+	{ kDecayId, &ParameterValues::decay, 0 },
+	{ kSustainId, &ParameterValues::sustain, 0 },
+	{ kReleaseId, &ParameterValues::release, 0 },
 
-	if (!s.readInt64u(version))
-		return kResultFalse;
-	if (!s.readDouble(volume))
+	{ kSinusVolumeId, &ParameterValues::sinusVolume, 0 },
+	{ kSquareVolumeId, &ParameterValues::squareVolume, 0 },
+	{ kSawVolumeId, &ParameterValues::sawVolume, 0 },
+	{ kTriVolumeId, &ParameterValues::triVolume, 0 },
+
+	{ kUnisonVoicesId, &ParameterValues::unisonVoices, 0 },
+	{ kUnisonDetuneId, &ParameterValues::unisonDetune, 0 },
+
+	{ kFilterCutoffId, &ParameterValues::filterCutoff, 0 },
+	{ kFilterResonanceId, &ParameterValues::filterResonance, 0 },
+	{ kFilterEnvelopeId, &ParameterValues::filterEnvelope, 0 },
+
+	{ kLfo1RateId, &ParameterValues::lfo1Rate, 0 },
+	{ kLfo1ShapeId, &ParameterValues::lfo1Shape, kNumLfoShapes },
+	{ kLfo2RateId, &ParameterValues::lfo2Rate, 0 },
+	{ kLfo2ShapeId, &ParameterValues::lfo2Shape, kNumLfoShapes },
+
+	{ kMod1SourceId, &ParameterValues::mod1Source, kNumModSources },
+	{ kMod1DestinationId, &ParameterValues::mod1Destination, kNumModDestinations },
+	{ kMod1AmountId, &ParameterValues::mod1Amount, 0 },
+	{ kMod2SourceId, &ParameterValues::mod2Source, kNumModSources },
+	{ kMod2DestinationId, &ParameterValues::mod2Destination, kNumModDestinations },
+	{ kMod2AmountId, &ParameterValues::mod2Amount, 0 },
+	{ kMod3SourceId, &ParameterValues::mod3Source, kNumModSources },
+	{ kMod3DestinationId, &ParameterValues::mod3Destination, kNumModDestinations },
+	{ kMod3AmountId, &ParameterValues::mod3Amount, 0 },
+	{ kMod4SourceId, &ParameterValues::mod4Source, kNumModSources },
+	{ kMod4DestinationId, &ParameterValues::mod4Destination, kNumModDestinations },
+	{ kMod4AmountId, &ParameterValues::mod4Amount, 0 },
+
+	{ kRepeatedNotesId, &ParameterValues::repeatedNotes, kNumRepeatedNoteModes },
+
+	{ kOutputRoutingId, &ParameterValues::outputRouting, kNumOutputRoutings },
+	{ kSplitKey1Id, &ParameterValues::splitKey1, 0 },
+	{ kSplitKey2Id, &ParameterValues::splitKey2, 0 },
+	{ kSplitKey3Id, &ParameterValues::splitKey3, 0 },
+
+	{ kSaveVoicesId, &ParameterValues::saveVoices, 0 },
+};
+
+const int32 ParameterValues::kNumSavedParameters = sizeof(kSavedParameters) / sizeof(kSavedParameters[0]);
+
+// Tuning list had 4 entries before version 1
+static ParamValue tuningFromLegacy(ParamValue tuning)
+{
+	int32 index = kEqualStepTuning;
+	if (tuning > 0.25)
+		index = tuning < 0.5 ? kPythagoreanTuning : (tuning < 0.75 ? kWerckmeisterIIITuning : kMeantoneTuning);
+	return (ParamValue)index / (kNumTunings - 1);
+}
+
+static tresult readLegacyState(StateReader& s, ParameterValues& state)
+{
+	int16 bypass = 0;
+
+	if (!s.read(state.volume))
 		return kResultFalse;
-	if (!s.readDouble(tuning))
+	if (!s.read(state.tuning))
 		return kResultFalse;
-	if (!s.readDouble(rootNote))
+	if (!s.read(state.rootNote))
 		return kResultFalse;
-	if (!s.readBool(bypass))
+	if (!s.read(bypass)) // IBStreamer wrote bools as int16
 		return kResultFalse;
 
-	if (!s.readDouble(attack))
+	if (!s.read(state.attack))
 		return kResultFalse;
-	if (!s.readDouble(decay))
+	if (!s.read(state.decay))
 		return kResultFalse;
-	if (!s.readDouble(sustain))
+	if (!s.read(state.sustain))
 		return kResultFalse;
-	if (!s.readDouble(release))
+	if (!s.read(state.release))
 		return kResultFalse;
 
-	if (!s.readDouble(sinusVolume))
+	if (!s.read(state.sinusVolume))
 		return kResultFalse;
-	if (!s.readDouble(squareVolume))
+	if (!s.read(state.squareVolume))
 		return kResultFalse;
-	if (!s.readDouble(sawVolume))
+	if (!s.read(state.sawVolume))
 		return kResultFalse;
-	if (!s.readDouble(triVolume))
+	if (!s.read(state.triVolume))
 		return kResultFalse;
 
+	state.bypass = bypass != 0;
+	state.tuning = tuningFromLegacy(state.tuning);
+
 	return kResultTrue;
 }
 
-tresult GlobalParameterState::getState(IBStream* stream)
+static tresult readParametersChunk(StateReader& s, ParameterValues& state)
 {
-	if (!stream)
-		return kResultFalse;
+	uint32 id;
+	double value;
+	while (!s.atEnd())
+	{
+		if (!s.read(id) || !s.read(value))
+			return kResultFalse;
 
-	IBStreamer s(stream, kLittleEndian);
+		if (id == kBypassId)
+			state.bypass = value > 0.5;
+		else
+			state.setSavedValue(id, value);
+	}
 
-	if (!s.writeInt64u(currentParameterStateVersion))
-		return kResultFalse;
-	if (!s.writeDouble(volume))
-		return kResultFalse;
-	if (!s.writeDouble(tuning))
-		return kResultFalse;
-	if (!s.writeDouble(rootNote))
-		return kResultFalse;
-	if (!s.writeBool(bypass))
-		return kResultFalse;
+	return kResultTrue;
+}
 
-	if (!s.writeDouble(attack))
-		return kResultFalse;
-	if (!s.writeDouble(decay))
-		return kResultFalse;
-	if (!s.writeDouble(sustain))
-		return kResultFalse;
-	if (!s.writeDouble(release))
+static tresult readCustomTuningChunk(StateReader& s, ParameterValues& state)
+{
+	uint32 count;
+	if (!s.read(count))
 		return kResultFalse;
 
-	if (!s.writeDouble(sinusVolume))
-		return kResultFalse;
-	if (!s.writeDouble(squareVolume))
-		return kResultFalse;
-	if (!s.writeDouble(sawVolume))
-		return kResultFalse;
-	if (!s.writeDouble(triVolume))
-		return kResultFalse;
+	for (uint32 i = 0; i < count; ++i)
+	{
+		double cents;
+		if (!s.read(cents))
+			return kResultFalse;
+		if (i < 12)
+			state.customTuning[i] = cents;
+	}
 
 	return kResultTrue;
 }
 
-std::tuple<ParamValue, ParamValue, ParamValue> GlobalParameterState::getMinMaxDefaultForParam(int paramID)
+void SmoothedParameters::setSampleRate(ParamValue sampleRate)
 {
-	switch (paramID)
+	coeff = 1.0 - exp(-1.0 / (0.01 * sampleRate)); // 10 ms
+}
+
+void SmoothedParameters::jumpTo(const ParamValue targets[kNumSmoothed])
+{
+	for (int32 p = 0; p < kNumSmoothed; ++p)
 	{
-	case kVolumeId:
-		return std::make_tuple(-60.0, 60.0, 0.0);
-	case kAttackId:
-	case kDecayId:
-	case kReleaseId:
-		return std::make_tuple(3.0, 10000.0, 10.0);
+		current[p] = targets[p];
+		std::fill(values[p], values[p] + kMaxSamples, targets[p]);
+	}
+}
+
+void SmoothedParameters::smooth(const ParamValue targets[kNumSmoothed], int32 numSamples)
+{
+	numSamples = std::min(numSamples, kMaxSamples);
+
+	for (int32 p = 0; p < kNumSmoothed; ++p)
+	{
+		ParamValue value = current[p];
+		const ParamValue target = targets[p];
+
+		// Settled, the modulation may have changed the buffer though
+		if (std::abs(target - value) <= 1e-6 * std::abs(target))
+		{
+			std::fill(values[p], values[p] + numSamples, target);
+			current[p] = target;
+			continue;
+		}
+
+		for (int32 i = 0; i < numSamples; ++i)
+		{
+			value += (target - value) * coeff;
+			values[p][i] = value;
+		}
+		current[p] = value;
 	}
+}
 
-	return std::make_tuple(0.0, 1.0, 0.0);
+void FilterSettings::update(ParamValue cutoff, ParamValue resonance, ParamValue envelopeAmount, ParamValue _sampleRate)
+{
+	envelopeOctaves = GlobalParameterState::paramToPlain(envelopeAmount, kFilterEnvelopeId) * 0.01 * 6.0; // 100 % is 6 octaves
+	enabled = cutoff < 1.0 || envelopeOctaves != 0.0;
+	cutoffRatio = GlobalParameterState::paramToPlain(cutoff, kFilterCutoffId) / _sampleRate;
+	g = getFilterG(cutoffRatio);
+	k = 2.0 - 1.96 * resonance; // Q from 0.5 to 25
 }
 
-ParamValue GlobalParameterState::paramToPlain(ParamValue normalized, int paramID)
+void ParameterValues::setDefaults()
+{
+	// The same defaults the controller shows
+	for (const auto& param : kSavedParameters)
+		this->*param.value = ParameterTable::find(param.id)->defaultNormalized;
+	bypass = false;
+
+	for (auto& cents : customTuning)
+		cents = 0.0;
+}
+
+void GlobalParameterState::setDefaults()
+{
+	ParameterValues::setDefaults();
+	markAllDirty();
+}
+
+void GlobalParameterState::setupProcessing(ParamValue sampleRate)
+{
+	processSampleRate = sampleRate;
+	resources = SampleRateResources::acquire(sampleRate);
+	markAllDirty();
+	updateDerived();
+
+	// Start at the current values, nothing to smooth from
+	smoothed.setSampleRate(sampleRate);
+	smoothed.jumpTo(derived.gainTargets);
+	modulation.setSampleRate(sampleRate);
+	modulation.reset();
+}
+
+void GlobalParameterState::setParameter(Vst::ParamID id, ParamValue value)
+{
+	for (int32 i = 0; i < kNumSavedParameters; ++i)
+	{
+		if (kSavedParameters[i].id == id)
+		{
+			this->*kSavedParameters[i].value = value;
+			dirty |= getDirtyFlags(id);
+			return;
+		}
+	}
+}
+
+uint32 GlobalParameterState::getDirtyFlags(Vst::ParamID id)
 {
-	std::tuple<ParamValue, ParamValue, ParamValue> minMaxDefault = getMinMaxDefaultForParam(paramID);
-	return normalized * (std::get<1>(minMaxDefault) - std::get<0>(minMaxDefault)) + std::get<0>(minMaxDefault);
+	if (id == kVolumeId || (id >= kSinusVolumeId && id <= kTriVolumeId))
+		return kDirtyGains;
+	if (id >= kAttackId && id <= kReleaseId)
+		return kDirtyEnvelope;
+	if (id >= kUnisonVoicesId && id <= kUnisonDetuneId)
+		return kDirtyUnison;
+	if (id >= kFilterCutoffId && id <= kFilterEnvelopeId)
+		return kDirtyFilter;
+	if (id >= kLfo1RateId && id <= kMod4AmountId)
+		return kDirtyModulation;
+	return 0; // read where they are used, like the tuning at note on
 }
 
-double VoiceStatics::pythagoreanOffsets[12];
-double VoiceStatics::werckmeisterIIIOffsets[12];
-double VoiceStatics::meantoneOffsets[12];
+void GlobalParameterState::updateDerived()
+{
+	if (!dirty)
+		return;
+
+	if (dirty & kDirtyGains)
+	{
+		derived.gainTargets[SmoothedParameters::kVolume] = fastDbToFactor(paramToPlain(volume, kVolumeId));
+		derived.gainTargets[SmoothedParameters::kSinusVolume] = 0.25 * sinusVolume;
+		derived.gainTargets[SmoothedParameters::kSquareVolume] = 0.25 * squareVolume;
+		derived.gainTargets[SmoothedParameters::kSawVolume] = 0.25 * sawVolume;
+		derived.gainTargets[SmoothedParameters::kTriVolume] = 0.25 * triVolume;
+		derived.gainTargets[SmoothedParameters::kPitchRatio] = 1.0;
+	}
+
+	if (dirty & kDirtyEnvelope)
+	{
+		derived.attackTime = paramToPlain(attack, kAttackId) * 0.001;
+		derived.attackSamples = derived.attackTime * processSampleRate;
+		derived.decayTime = paramToPlain(decay, kDecayId) * 0.001;
+		derived.releaseTime = paramToPlain(release, kReleaseId) * 0.001;
+	}
 
-double VoiceStatics::getPythagoreanOffset(int32 pitch, int32 rootPitch)
+	if (dirty & kDirtyUnison)
+		unison.update(getUnisonVoices(), paramToPlain(unisonDetune, kUnisonDetuneId));
+
+	if (dirty & kDirtyFilter)
+		filter.update(filterCutoff, filterResonance, filterEnvelope, processSampleRate);
+
+	if (dirty & kDirtyModulation)
+		getModulationSettings(derived.modulation);
+
+	dirty = 0;
+}
+
+void GlobalParameterState::prepareSubBlock(int32 numSamples)
 {
-	int32 pitchMod = (pitch - rootPitch) % 12;
-	//double octaves = trunc((double)pitch - rootPitch);
-	return pythagoreanOffsets[pitchMod];// +octaves * 1200.0;
+	smoothed.smooth(derived.gainTargets, numSamples);
+	modulation.process(derived.modulation, numSamples);
+
+	// Modulation of the gains on top of the smoothed values
+	static const int32 gainDestinations[][2] =
+	{
+		{ kModDestinationVolume, SmoothedParameters::kVolume },
+		{ kModDestinationSinusVolume, SmoothedParameters::kSinusVolume },
+		{ kModDestinationSquareVolume, SmoothedParameters::kSquareVolume },
+		{ kModDestinationSawVolume, SmoothedParameters::kSawVolume },
+		{ kModDestinationTriVolume, SmoothedParameters::kTriVolume },
+	};
+	for (const auto& destination : gainDestinations)
+	{
+		if (!modulation.isActive(destination[0]))
+			continue;
+		const ParamValue* mod = modulation.getValues(destination[0]);
+		ParamValue* values = smoothed.values[destination[1]];
+		for (int32 i = 0; i < numSamples; ++i)
+			values[i] *= std::max(1.0 + mod[i], 0.0);
+	}
+
+	if (modulation.isActive(kModDestinationPitch))
+	{
+		const ParamValue* mod = modulation.getValues(kModDestinationPitch);
+		ParamValue* values = smoothed.values[SmoothedParameters::kPitchRatio];
+		for (int32 i = 0; i < numSamples; ++i)
+			values[i] = fastExp2(mod[i]); // 1 is an octave
+	}
 }
 
-double VoiceStatics::getWerckmeisterIIIOffset(int32 pitch, int32 rootPitch)
+void GlobalParameterState::getSnapshot(Snapshot& snapshot) const
 {
-	int32 pitchMod = (pitch - rootPitch) % 12;
-	//double octaves = trunc((double)pitch - rootPitch);
-	return werckmeisterIIIOffsets[pitchMod];// +octaves * 1200.0;
+	for (int32 i = 0; i < SmoothedParameters::kNumSmoothed; ++i)
+		snapshot.smoothed[i] = smoothed.current[i];
+	modulation.getSnapshot(snapshot.modulation);
 }
 
-double VoiceStatics::getMeantoneOffset(int32 pitch, int32 rootPitch)
+void GlobalParameterState::setSnapshot(const Snapshot& snapshot)
 {
-	int32 pitchMod = (pitch - rootPitch) % 12;
-	//double octaves = trunc((double)pitch - rootPitch);
-	return meantoneOffsets[pitchMod];// +octaves * 1200.0;
+	for (int32 i = 0; i < SmoothedParameters::kNumSmoothed; ++i)
+		smoothed.current[i] = snapshot.smoothed[i];
+	modulation.setSnapshot(snapshot.modulation);
 }
 
-class VoiceStaticsOnce
+void GlobalParameterState::getModulationSettings(ModulationSettings& settings) const
 {
-public:
-	VoiceStaticsOnce()
+	settings.lfoRate[0] = paramToPlain(lfo1Rate, kLfo1RateId);
+	settings.lfoRate[1] = paramToPlain(lfo2Rate, kLfo2RateId);
+	settings.lfoShape[0] = toListIndex(lfo1Shape, kNumLfoShapes);
+	settings.lfoShape[1] = toListIndex(lfo2Shape, kNumLfoShapes);
+
+	const ParamValue ParameterValues::* slotParameters[ModulationSettings::kNumSlots][3] =
 	{
-		static const double pComma = 1200.0 * log2(pow(1.5, 12.0) / pow(2.0, 7.0)); // in Cents
-		static const double sComma = 1200.0 * log2(81.0 / 80.0); // in Cents
+		{ &ParameterValues::mod1Source, &ParameterValues::mod1Destination, &ParameterValues::mod1Amount },
+		{ &ParameterValues::mod2Source, &ParameterValues::mod2Destination, &ParameterValues::mod2Amount },
+		{ &ParameterValues::mod3Source, &ParameterValues::mod3Destination, &ParameterValues::mod3Amount },
+		{ &ParameterValues::mod4Source, &ParameterValues::mod4Destination, &ParameterValues::mod4Amount },
+	};
+	for (int32 i = 0; i < ModulationSettings::kNumSlots; ++i)
+	{
+		settings.slots[i].source = toListIndex(this->*slotParameters[i][0], kNumModSources);
+		settings.slots[i].destination = toListIndex(this->*slotParameters[i][1], kNumModDestinations);
+		settings.slots[i].amount = 2.0 * (this->*slotParameters[i][2]) - 1.0;
+	}
+}
 
-		//VoiceStatics::pythagoreanOffsets[0] = 0.0;																// unison
-		//VoiceStatics::pythagoreanOffsets[1] = 1200.0 * log2( pow(3.0 / 2.0, -5.0) * pow(2.0,  3.0) ) - 100.0;	// minor second
-		//VoiceStatics::pythagoreanOffsets[2] = 1200.0 * log2( pow(3.0 / 2.0,  2.0) * 0.5			   ) - 200.0;	// major second
-		//VoiceStatics::pythagoreanOffsets[3] = 1200.0 * log2( pow(3.0 / 2.0, -3.0) * 4.0            ) - 300.0;	// minor third
-		//VoiceStatics::pythagoreanOffsets[4] = 1200.0 * log2( pow(3.0 / 2.0,  4.0) * 1.0 / 4.0	   ) - 400.0;	// major third
-		//VoiceStatics::pythagoreanOffsets[5] = 1200.0 * log2( 4.0 / 3.0							   ) - 500.0;	// fourth
-		//VoiceStatics::pythagoreanOffsets[6] = 0.0;																// augmented fourth / diminished fifth => undefined
-		//VoiceStatics::pythagoreanOffsets[7] = 1200.0 * log2( 3.0 / 2.0							   ) - 700.0;	// fifth
-		//VoiceStatics::pythagoreanOffsets[8] = 1200.0 * log2( pow(3.0 / 2.0, -4.0) * pow(2.0,  3.0) ) - 800.0;	// minor sixth
-		//VoiceStatics::pythagoreanOffsets[9] = 1200.0 * log2( pow(3.0 / 2.0,  3.0) * 0.5			   ) - 900.0;	// major sixth
-		//VoiceStatics::pythagoreanOffsets[9] = 1200.0 * log2( pow(3.0 / 2.0, -2.0) * 4.0			   ) - 1000.0;	// minor seventh
-		//VoiceStatics::pythagoreanOffsets[9] = 1200.0 * log2( pow(3.0 / 2.0,  5.0) * 1.0 / 4.0      ) - 1100.0;	// major seventh
+int32 GlobalParameterState::getUnisonVoices() const
+{
+	return std::min(std::max((int32)(unisonVoices * (UnisonSpread::kMaxOscillators - 1) + 0.5), int32(0)), UnisonSpread::kMaxOscillators - 1) + 1;
+}
 
+void UnisonSpread::update(int32 _numOscillators, ParamValue detuneCents)
+{
+	numOscillators = _numOscillators;
+
+	for (int32 k = 0; k < numOscillators; ++k)
+	{
+		const ParamValue cents = numOscillators > 1 ? detuneCents * (2.0 * k / (numOscillators - 1) - 1.0) : 0.0;
+		ratios[k] = fastExp2(cents / 1200.0);
+	}
+	gain = 1.0 / sqrt((ParamValue)numOscillators);
+}
+
+double ParameterValues::getSavedValue(const SavedParameter& param) const
+{
+	if (param.numListEntries > 0)
+		return (double)GlobalParameterState::toListIndex(this->*param.value, param.numListEntries);
+	return this->*param.value;
+}
+
+void ParameterValues::setSavedValue(Vst::ParamID id, double value)
+{
+	for (const auto& param : kSavedParameters)
+	{
+		if (param.id == id)
+		{
+			if (param.numListEntries > 0)
+				value = std::min(std::max(value, 0.0), param.numListEntries - 1.0) / (param.numListEntries - 1);
+			this->*param.value = value;
+			return;
+		}
+	}
+}
+
+ParamValue ParameterValues::getNormalized(const SavedParameter& param) const
+{
+	if (param.id == kRootNoteId)
+		return rootNote / 128.0;
+	return this->*param.value;
+}
+
+int32 GlobalParameterState::getTuning() const
+{
+	return toListIndex(tuning, kNumTunings);
+}
+
+int32 GlobalParameterState::getOutputBus(int32 channel, int32 pitch) const
+{
+	switch (toListIndex(outputRouting, kNumOutputRoutings))
+	{
+	case kRouteByChannel:
+		return channel % MAX_OUTPUT_BUSES;
+	case kRouteByKeyRange:
+	{
+		int32 bus = 0;
+		for (ParamValue splitKey : { splitKey1, splitKey2, splitKey3 })
+		{
+			if (pitch >= (int32)(paramToPlain(splitKey, kSplitKey1Id) + 0.5))
+				++bus;
+		}
+		return bus;
+	}
+	}
+	return 0;
+}
+
+int32 GlobalParameterState::toListIndex(ParamValue normalized, int32 numListEntries)
+{
+	return std::min(std::max((int32)(normalized * (numListEntries - 1) + 0.5), int32(0)), numListEntries - 1);
+}
+
+tresult ParameterValues::setState(IBStream* stream, StateChunkHandler* extraChunks)
+{
+	if (!stream)
+		return kResultFalse;
+
+	std::vector<uint8> buffer;
+	if (!readStream(stream, buffer))
+		return kResultFalse;
+
+	StateReader s(buffer.data(), buffer.size());
+
+	// Load the values on their own, so a broken state leaves the current one untouched
+	ParameterValues state;
+	state.setDefaults();
+
+	uint32 magic = 0;
+	if (!s.read(magic))
+		return kResultFalse;
+
+	if (magic != kStateMagic)
+	{
+		uint32 versionHighBits = 0;
+		if (magic != 0 || !s.read(versionHighBits) || versionHighBits != 0)
+			return kResultFalse;
+		if (readLegacyState(s, state) != kResultTrue)
+			return kResultFalse;
+	}
+	else
+	{
+		uint32 version = 0;
+		if (!s.read(version) || version < 1)
+			return kResultFalse;
+
+		std::vector<std::pair<uint32, StateReader>> unknownChunks;
+
+		while (!s.atEnd())
+		{
+			uint32 tag, size;
+			StateReader chunk(nullptr, 0);
+			if (!s.read(tag) || !s.read(size) || !s.sub(size, chunk))
+				return kResultFalse;
+
+			const tresult res = state.readParameterChunk(tag, chunk);
+			if (res == kNotImplemented) // for extraChunks or from a newer version
+				unknownChunks.emplace_back(tag, chunk);
+			else if (res != kResultTrue)
+				return res;
+		}
+
+		if (extraChunks)
+		{
+			for (auto& chunk : unknownChunks)
+				extraChunks->readChunk(chunk.first, chunk.second);
+		}
+	}
+
+	*this = state;
+	return kResultTrue;
+}
+
+tresult ParameterValues::getState(IBStream* stream, StateChunkHandler* extraChunks) const
+{
+	if (!stream)
+		return kResultFalse;
+
+	StateWriter s;
+	s.write(kStateMagic);
+	s.write(currentParameterStateVersion);
+
+	writeParameterChunks(s);
+
+	if (extraChunks)
+		extraChunks->writeChunks(s);
+
+	return s.flush(stream);
+}
+
+tresult ParameterValues::readParameterChunk(uint32 tag, StateReader& chunk)
+{
+	switch (tag)
+	{
+	case kParametersChunk:
+		return readParametersChunk(chunk, *this);
+	case kCustomTuningChunk:
+		return readCustomTuningChunk(chunk, *this);
+	}
+	return kNotImplemented;
+}
+
+void ParameterValues::writeParameterChunks(StateWriter& s) const
+{
+	s.beginChunk(kParametersChunk);
+	s.write(uint32(kBypassId));
+	s.write(double(bypass ? 1.0 : 0.0));
+	for (const auto& param : kSavedParameters)
+	{
+		s.write(uint32(param.id));
+		s.write(getSavedValue(param));
+	}
+	s.endChunk();
+
+	s.beginChunk(kCustomTuningChunk);
+	s.write(uint32(12));
+	for (double cents : customTuning)
+		s.write(cents);
+	s.endChunk();
+}
+
+ParamValue GlobalParameterState::paramToPlain(ParamValue normalized, int paramID)
+{
+	const ParameterDescription* param = ParameterTable::find(paramID);
+	if (!param)
+		return normalized;
+	if (param->scale == kScaleLogarithmic)
+		return param->minPlain * fastPow(param->maxPlain / param->minPlain, normalized);
+	return param->toPlain(normalized);
+}
+
+// std::log2 is not constexpr, these are log2(3 / 2) and log2(81 / 80)
+static constexpr double kLog2Fifth = 0.58496250072115618145;
+static constexpr double kLog2SyntonicComma = 0.01792190799726237794;
+
+static constexpr double kPythagoreanComma = 1200.0 * (12.0 * kLog2Fifth - 7.0); // in Cents
+static constexpr double kSyntonicComma = 1200.0 * kLog2SyntonicComma; // in Cents
+
+// Offsets in Cents from equal step tuning per interval above the root note, computed by the
+// compiler so loading the module runs no initialisation code
+struct TuningOffsets
+{
+	double offsets[kNumTunings][12]; // equal step and custom tuning stay 0
+
+	constexpr TuningOffsets() : offsets()
+	{
 		for (int i = 0; i < 12; ++i)
 		{
 			const int numFifths = (i * 7 + 5) % 12 - 5; // in range [-5:6]
 			const int numOctaves = (i * 3 + 3) % 7 - 3; // in range [-3:3]
-			VoiceStatics::pythagoreanOffsets[i] = 1200.0 * log2(pow(1.5, numFifths) * pow(2.0, numOctaves)) - i * 100.0;
-			VoiceStatics::werckmeisterIIIOffsets[i] = VoiceStatics::pythagoreanOffsets[i];
+			const double pythagorean = 1200.0 * (numFifths * kLog2Fifth + numOctaves) - i * 100.0;
+			offsets[kPythagoreanTuning][i] = pythagorean;
+
+			double& werckmeisterIII = offsets[kWerckmeisterIIITuning][i];
+			werckmeisterIII = pythagorean;
 			if (numFifths >= 1 && numFifths <= 3)
-				VoiceStatics::werckmeisterIIIOffsets[i] -= 0.25 * pComma * numFifths;
+				werckmeisterIII -= 0.25 * kPythagoreanComma * numFifths;
 			else if (numFifths == 6)
-				VoiceStatics::werckmeisterIIIOffsets[i] -= pComma;
-			VoiceStatics::meantoneOffsets[i] = VoiceStatics::pythagoreanOffsets[i] - 0.25 * sComma * numFifths;
+				werckmeisterIII -= kPythagoreanComma;
+
+			offsets[kMeantoneTuning][i] = pythagorean - 0.25 * kSyntonicComma * numFifths;
+
+			// C-G-D-A-E narrowed by 1/4 syntonic comma, F#-C# by the schisma, the others pure
+			const int numKirnbergerFifths = numFifths < 0 ? 0 : (numFifths > 4 ? 4 : numFifths);
+			offsets[kKirnbergerIIITuning][i] = pythagorean - 0.25 * kSyntonicComma * numKirnbergerFifths;
+
+			// F-C-G-D-A-E-B narrowed by 1/6 Pythagorean comma, the others pure
+			const int numVallottiFifths = numFifths < -1 ? -1 : (numFifths > 5 ? 5 : numFifths);
+			offsets[kVallottiTuning][i] = pythagorean - kPythagoreanComma / 6.0 * numVallottiFifths;
+
+			// Major thirds and sixths are a syntonic comma below the Pythagorean ones, minor
+			// ones above
+			offsets[kJustTuning][i] = pythagorean + (numFifths <= -2 ? kSyntonicComma : (numFifths >= 3 ? -kSyntonicComma : 0.0));
 		}
 	}
 };
 
-static VoiceStaticsOnce _gVoiceStaticsOnce;
+static constexpr TuningOffsets kTuningOffsets;
+
+static inline int32 intervalAboveRoot(int32 pitch, int32 rootPitch)
+{
+	return ((pitch - rootPitch) % 12 + 12) % 12;
+}
+
+double VoiceStatics::getOffset(int32 tuning, int32 pitch, int32 rootPitch)
+{
+	if (tuning < 0 || tuning >= kNumTunings)
+		return 0.0;
+	return kTuningOffsets.offsets[tuning][intervalAboveRoot(pitch, rootPitch)];
+}
+
+double VoiceStatics::getCustomOffset(const GlobalParameterState& state, int32 pitch, int32 rootPitch)
+{
+	return state.customTuning[intervalAboveRoot(pitch, rootPitch)];
+}
 
 }
-}
\ No newline at end of file
+}
@@ -0,0 +1,118 @@
+
+#include "../include/fastmath.h"
+#include "../include/voicefilter.h"
+
+#include <cstdio>
+
+using namespace Benergy::BadTempered;
+
+// Sweeps every approximation over its documented domain and compares it with libm.
+// Returns nonzero if an error bound in fastmath.h doesn't hold.
+
+namespace {
+
+const int kNumSteps = 1 << 20;
+
+struct ErrorCheck
+{
+	const char* name;
+	double maxError = 0;
+	double worstInput = 0;
+
+	void add(double input, double error)
+	{
+		if (!(error <= maxError)) // also catches NaN
+		{
+			maxError = error;
+			worstInput = input;
+		}
+	}
+
+	bool check(double bound) const
+	{
+		const bool passed = maxError <= bound;
+		printf("%-16s max error %.3g at %.17g, bound %.3g %s\n", name, maxError, worstInput, bound, passed ? "ok" : "FAILED");
+		return passed;
+	}
+};
+
+double relativeError(double value, double reference)
+{
+	return std::fabs(value - reference) / std::fabs(reference);
+}
+
+template <class Function>
+void sweep(double from, double to, Function function)
+{
+	for (int i = 0; i <= kNumSteps; i++)
+		function(from + (to - from) * i / kNumSteps);
+}
+
+}
+
+int main()
+{
+	bool passed = true;
+
+	ErrorCheck exp2Check {"fastExp2"};
+	sweep(-1022.0, 1023.0, [&](double x) { exp2Check.add(x, relativeError(fastExp2(x), std::exp2(x))); });
+	// Around 0 in fine steps too, the voices mostly use that part
+	sweep(-4.0, 4.0, [&](double x) { exp2Check.add(x, relativeError(fastExp2(x), std::exp2(x))); });
+	passed &= exp2Check.check(1e-8);
+
+	ErrorCheck log2Check {"fastLog2"};
+	sweep(-1022.0, 1023.0, [&](double e) {
+		const double x = std::exp2(e);
+		log2Check.add(x, std::fabs(fastLog2(x) - std::log2(x)));
+	});
+	sweep(0.25, 4.0, [&](double x) { log2Check.add(x, std::fabs(fastLog2(x) - std::log2(x))); });
+	passed &= log2Check.check(2e-9);
+
+	ErrorCheck expCheck {"fastExp"};
+	sweep(-708.0, 709.0, [&](double x) { expCheck.add(x, relativeError(fastExp(x), std::exp(x))); });
+	passed &= expCheck.check(1e-8);
+
+	ErrorCheck logCheck {"fastLog"};
+	sweep(-1022.0, 1023.0, [&](double e) {
+		const double x = std::exp2(e);
+		logCheck.add(x, std::fabs(fastLog(x) - std::log(x)));
+	});
+	sweep(1e-6, 2.0, [&](double x) { logCheck.add(x, std::fabs(fastLog(x) - std::log(x))); });
+	passed &= logCheck.check(1e-9);
+
+	// Bases and exponents as used for logarithmic parameters
+	ErrorCheck powCheck {"fastPow"};
+	for (double base : {1e-3, 0.5, 1.5, 2.0, 10.0, 1000.0, 20000.0})
+	{
+		sweep(-10.0, 10.0, [&](double exponent) {
+			// Scaled so the documented bound of 1e-8 + 1e-9 * |exponent| becomes 1e-8
+			const double reference = std::pow(base, exponent);
+			powCheck.add(base, relativeError(fastPow(base, exponent), reference) / (1.0 + 0.1 * std::fabs(exponent)));
+		});
+	}
+	passed &= powCheck.check(1e-8);
+
+	ErrorCheck dbCheck {"fastDbToFactor"};
+	sweep(-120.0, 24.0, [&](double dB) { dbCheck.add(dB, relativeError(fastDbToFactor(dB), std::pow(10.0, dB / 20.0))); });
+	passed &= dbCheck.check(1e-8);
+
+	ErrorCheck sinCheck {"fastSin2Pi"};
+	const double kTwoPi = 6.28318530717958647693;
+	sweep(-4.0, 4.0, [&](double turns) { sinCheck.add(turns, std::fabs(fastSin2Pi(turns) - std::sin(kTwoPi * turns))); });
+	// Far from 0 as the LFO phases
+	sweep(1000.0, 1001.0, [&](double turns) { sinCheck.add(turns, std::fabs(fastSin2Pi(turns) - std::sin(kTwoPi * turns))); });
+	passed &= sinCheck.check(6e-8);
+
+	ErrorCheck phaseCheck {"fastSin2PiPhase"};
+	sweep(0.0, 1.0 - 1.0 / kNumSteps, [&](double turns) { phaseCheck.add(turns, std::fabs(fastSin2PiPhase(turns) - std::sin(kTwoPi * turns))); });
+	passed &= phaseCheck.check(6e-8);
+
+	// The filter coefficient, relative as tan grows large near Nyquist
+	ErrorCheck tanCheck {"getFilterG"};
+	sweep(1e-5, 0.49, [&](double cutoffRatio) {
+		tanCheck.add(cutoffRatio, relativeError(getFilterG(cutoffRatio), std::tan(0.5 * kTwoPi * cutoffRatio)));
+	});
+	passed &= tanCheck.check(1e-7);
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+
+#include "../tests/testhost.h"
+#include "../tools/offlinerenderer.h"
+#include "../include/parameters.h"
+#include "../include/plugids.h"
+
+#include "public.sdk/source/common/memorystream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace Benergy::BadTempered;
+
+// Renders a timeline of phrases with silence between them through the OfflineRenderer, which
+// splits it into segments rendered in parallel, and through a single processor. Both have to
+// be the same sample for sample, the root notes set by the bass bus included. Once more from a
+// state saved with a held note, which has to end before the second phrase.
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const int32 kBlockSize = 512;
+const int32 kNumPhrases = 6;
+const double kPhraseLength = 3.0; // in s, longer than kMinSegmentLength
+const double kNoteLength = 0.7;
+
+std::vector<char> makeState(bool holdNote)
+{
+	TestHost host(kSampleRate, Vst::kOffline);
+	host.parameterChanges.add(kVolumeId, 0, ParameterTable::find(kVolumeId)->toNormalized(0.0));
+	host.parameterChanges.add(kTuningId, 0, ParameterTable::find(kTuningId)->toNormalized(2)); // Werckmeister III, depends on the root
+	host.parameterChanges.add(kAttackId, 0, ParameterTable::find(kAttackId)->toNormalized(10.0));
+	host.parameterChanges.add(kSustainId, 0, 0.7);
+	host.parameterChanges.add(kReleaseId, 0, ParameterTable::find(kReleaseId)->toNormalized(500.0));
+	if (holdNote)
+	{
+		host.parameterChanges.add(kSaveVoicesId, 0, 1.0);
+		host.events.add(TestHost::makeNoteOn(0, 72));
+	}
+	host.process(kBlockSize);
+
+	// The voices published by that block, the first one with the note sounding
+	MemoryStream stream;
+	host.getProcessor().getState(&stream);
+	return std::vector<char>(stream.getData(), stream.getData() + stream.getSize());
+}
+
+std::vector<OfflineRenderer::TimelineEvent> makeTimeline()
+{
+	std::vector<OfflineRenderer::TimelineEvent> timeline;
+	auto add = [&](double seconds, const Vst::Event& e) { timeline.push_back({ (int64)(seconds * kSampleRate), e }); };
+
+	for (int32 p = 0; p < kNumPhrases; ++p)
+	{
+		const double start = p * kPhraseLength + 0.013 * p; // not block aligned
+		const int16 root = (int16)(36 + 5 * p % 12);
+		add(start, TestHost::makeNoteOn(0, root, 0.8f, 0, 1));
+		for (int16 interval : {24, 28, 31})
+			add(start + 0.001 * interval, TestHost::makeNoteOn(0, (int16)(root + interval), 0.5f + 0.01f * interval));
+		for (int16 interval : {24, 28, 31})
+			add(start + kNoteLength + 0.002 * interval, TestHost::makeNoteOff(0, (int16)(root + interval)));
+		add(start + kNoteLength, TestHost::makeNoteOff(0, root, 0, 1));
+	}
+	std::stable_sort(timeline.begin(), timeline.end(), [](const OfflineRenderer::TimelineEvent& a, const OfflineRenderer::TimelineEvent& b) {
+		return a.position < b.position;
+	});
+	return timeline;
+}
+
+// Like a host playing the whole timeline, with the same blocks as the renderer
+void renderReference(const std::vector<char>& state, const std::vector<OfflineRenderer::TimelineEvent>& timeline, float* left, float* right, int64 numSamples)
+{
+	// Loaded while inactive like the renderer does, so nothing is smoothed from the defaults
+	TestHost host(kSampleRate, Vst::kOffline);
+	host.stop();
+	MemoryStream stream(const_cast<char*>(state.data()), (TSize)state.size());
+	host.getProcessor().setState(&stream);
+	host.start();
+
+	size_t eventIndex = 0;
+	for (int64 position = 0; position < numSamples; position += kBlockSize)
+	{
+		const int32 numSamplesInBlock = (int32)std::min((int64)kBlockSize, numSamples - position);
+		for (; eventIndex < timeline.size() && timeline[eventIndex].position < position + numSamplesInBlock; ++eventIndex)
+		{
+			Vst::Event e = timeline[eventIndex].event;
+			e.sampleOffset = (int32)(timeline[eventIndex].position - position);
+			host.events.add(e);
+		}
+		host.process(numSamplesInBlock);
+		std::copy(host.getOutput(0), host.getOutput(0) + numSamplesInBlock, left + position);
+		std::copy(host.getOutput(1), host.getOutput(1) + numSamplesInBlock, right + position);
+	}
+}
+
+bool checkRender(const char* name, bool holdNote)
+{
+	const std::vector<char> state = makeState(holdNote);
+	const std::vector<OfflineRenderer::TimelineEvent> timeline = makeTimeline();
+	const int64 numSamples = (int64)(kNumPhrases * kPhraseLength * kSampleRate);
+
+	std::vector<float> left(numSamples), right(numSamples);
+	OfflineRenderer renderer(state.data(), (int32)state.size(), kSampleRate, kBlockSize);
+	if (renderer.render(timeline.data(), (int32)timeline.size(), left.data(), right.data(), numSamples) != kResultOk)
+	{
+		printf("%s: render FAILED\n", name);
+		return false;
+	}
+
+	std::vector<float> referenceLeft(numSamples), referenceRight(numSamples);
+	renderReference(state, timeline, referenceLeft.data(), referenceRight.data(), numSamples);
+
+	double maxDiff = 0;
+	double peak = 0;
+	for (int64 i = 0; i < numSamples; ++i)
+	{
+		maxDiff = std::max(maxDiff, (double)std::max(std::fabs(left[i] - referenceLeft[i]), std::fabs(right[i] - referenceRight[i])));
+		peak = std::max(peak, (double)std::fabs(referenceLeft[i]));
+	}
+
+	const bool passed = renderer.getNumSegments() == kNumPhrases && peak > 0.01 && maxDiff == 0.0;
+	printf("%s: %d segments, peak %g, max difference %g %s\n", name, renderer.getNumSegments(), peak, maxDiff, passed ? "ok" : "FAILED");
+	return passed;
+}
+
+}
+
+int main()
+{
+	bool passed = checkRender("timeline", false);
+	passed &= checkRender("with a held note in the state", true);
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+
+#include "../tests/testhost.h"
+#include "../include/parameters.h"
+#include "../include/plugids.h"
+#include "../include/presetbank.h"
+#include "../include/statechunks.h"
+
+#include "public.sdk/source/common/memorystream.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace Benergy::BadTempered;
+
+// Writes a bank of two presets which differ in every saved parameter, maps it and switches
+// between them on the main parameters and on a part. After each switch the state has to hold
+// exactly the values of the preset, with the bypass left as it was.
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const int32 kBlockSize = 256;
+const char* kBankPath = "presetbanktest.bank";
+
+const uint32 kParametersChunk = makeChunkTag('P', 'A', 'R', 'M');
+const uint32 kCustomTuningChunk = makeChunkTag('T', 'U', 'N', 'E');
+const uint32 kPartChunk = makeChunkTag('P', 'A', 'R', 'T');
+
+// Every value differs between the two variants, lists included
+ParameterValues makePreset(int32 variant)
+{
+	ParameterValues values;
+	values.setDefaults();
+	for (int32 p = 0; p < ParameterValues::kNumSavedParameters; ++p)
+	{
+		const auto& param = ParameterValues::kSavedParameters[p];
+		if (param.numListEntries > 0)
+			values.setSavedValue(param.id, (p + variant) % param.numListEntries);
+		else
+			values.setSavedValue(param.id, (variant == 0 ? 0.1 : 0.6) + 0.003 * p);
+	}
+	for (int32 i = 0; i < 12; ++i)
+		values.customTuning[i] = variant == 0 ? i : -2.0 * i;
+	return values;
+}
+
+struct SavedValues
+{
+	std::map<uint32, double> values;
+	std::vector<double> customTuning;
+};
+
+void readParameterChunk(uint32 tag, StateReader& chunk, SavedValues& saved)
+{
+	uint32 id, count;
+	double value;
+	if (tag == kParametersChunk)
+	{
+		while (chunk.read(id) && chunk.read(value))
+			saved.values[id] = value;
+	}
+	else if (tag == kCustomTuningChunk && chunk.read(count))
+	{
+		while (chunk.read(value))
+			saved.customTuning.push_back(value);
+	}
+}
+
+// The main parameters under channel 0, the parts under theirs
+std::map<uint32, SavedValues> readState(const std::vector<char>& state)
+{
+	std::map<uint32, SavedValues> channels;
+	StateReader s(reinterpret_cast<const uint8*>(state.data()), state.size());
+	uint32 magic, version, tag, size, channel;
+	if (!s.read(magic) || !s.read(version))
+		return channels;
+
+	StateReader chunk, partChunk;
+	while (s.read(tag) && s.read(size) && s.sub(size, chunk))
+	{
+		if (tag == kPartChunk && chunk.read(channel))
+		{
+			while (chunk.read(tag) && chunk.read(size) && chunk.sub(size, partChunk))
+				readParameterChunk(tag, partChunk, channels[channel]);
+		}
+		else
+			readParameterChunk(tag, chunk, channels[0]);
+	}
+	return channels;
+}
+
+std::vector<char> saveState(TestHost& host)
+{
+	MemoryStream stream;
+	host.getProcessor().getState(&stream);
+	return std::vector<char>(stream.getData(), stream.getData() + stream.getSize());
+}
+
+bool checkValues(const char* name, const SavedValues& saved, const ParameterValues& preset, bool bypass)
+{
+	int32 numWrong = 0;
+	for (int32 p = 0; p < ParameterValues::kNumSavedParameters; ++p)
+	{
+		const auto& param = ParameterValues::kSavedParameters[p];
+		const auto value = saved.values.find(param.id);
+		if (value == saved.values.end() || value->second != preset.getSavedValue(param))
+		{
+			printf("%s: parameter %u is %g instead of %g\n", name, param.id, value == saved.values.end() ? -1.0 : value->second, preset.getSavedValue(param));
+			++numWrong;
+		}
+	}
+	const auto savedBypass = saved.values.find(kBypassId);
+	const bool bypassKept = savedBypass != saved.values.end() && (savedBypass->second > 0.5) == bypass;
+	const bool tuningMatches = saved.customTuning == std::vector<double>(preset.customTuning, preset.customTuning + 12);
+
+	const bool passed = numWrong == 0 && bypassKept && tuningMatches;
+	printf("%s: %d of %d values wrong, bypass %s, custom tuning %s %s\n", name, numWrong, ParameterValues::kNumSavedParameters,
+		bypassKept ? "kept" : "changed", tuningMatches ? "matches" : "differs", passed ? "ok" : "FAILED");
+	return passed;
+}
+
+}
+
+int main()
+{
+	bool passed = true;
+	const ParameterValues presets[] = { makePreset(0), makePreset(1) };
+	if (!PresetBank::write(kBankPath, { { "First", presets[0] }, { "Second", presets[1] } }))
+	{
+		printf("writing %s FAILED\n", kBankPath);
+		return 1;
+	}
+
+	// Mapped on its own, found by index and by name
+	{
+		PresetBank bank;
+		const bool opened = bank.open(kBankPath);
+		const bool found = opened && bank.getNumPresets() == 2 && bank.findPreset("Second") == bank.getPreset(1)
+			&& bank.findPreset("First") == bank.getPreset(0) && bank.findPreset("Third") == nullptr;
+		printf("bank: %s %s\n", opened ? "opened" : "not opened", found ? "ok" : "FAILED");
+		passed &= found;
+	}
+
+	// The processor loads the bank with a state naming it
+	TestHost host(kSampleRate, Vst::kOffline);
+	host.parameterChanges.add(kBypassId, 0, 1.0);
+	host.process(kBlockSize);
+	{
+		std::vector<char> state = saveState(host);
+		StateWriter bankChunk;
+		bankChunk.beginChunk(makeChunkTag('B', 'A', 'N', 'K'));
+		bankChunk.writeBytes(kBankPath, strlen(kBankPath));
+		bankChunk.endChunk();
+		state.insert(state.end(), bankChunk.data(), bankChunk.data() + bankChunk.size());
+
+		MemoryStream stream(state.data(), (TSize)state.size());
+		host.getProcessor().setState(&stream);
+	}
+
+	// Both ways, so nothing of the previous preset is left over
+	for (int32 index : {1, 0, 1})
+	{
+		host.parameterChanges.add(kPresetId, 0, index / 127.0);
+		host.process(kBlockSize);
+		const std::string name = "preset " + std::to_string(index);
+		passed &= checkValues(name.c_str(), readState(saveState(host))[0], presets[index], true);
+	}
+
+	// A part starts from the main parameters and takes all of its preset
+	host.parameterChanges.add(kPartPresetId + 2, 0, 0.0);
+	host.process(kBlockSize);
+	std::map<uint32, SavedValues> channels = readState(saveState(host));
+	passed &= checkValues("part preset 0", channels[2], presets[0], true);
+	passed &= checkValues("main after the part preset", channels[0], presets[1], true);
+
+	remove(kBankPath);
+	return passed ? 0 : 1;
+}
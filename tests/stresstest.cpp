@@ -0,0 +1,306 @@
+
+#include "../tests/testhost.h"
+#include "../include/parameters.h"
+#include "../include/plugids.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace Benergy::BadTempered;
+
+// Drives PlugProcessor::process with seeded random input: storms of note ons, a root change
+// on every sample, automation of all parameters and random block sizes, at full volume with
+// the shortest attack and the longest release so the voices pile up. Fails on allocations or locks inside
+// process, and on NaN, infinite or denormal output. The seed is fixed so ctest runs the same
+// input every time, run with another seed or "random" to try more input, and with a number
+// of blocks to run longer.
+//
+//   stresstest [seed | random] [blocks]
+//
+// Allocations and locks are caught by replacing malloc and the pthread locks of glibc in
+// this executable, so the test only builds on Linux.
+
+namespace {
+
+thread_local bool inProcess = false;
+int numAllocations = 0;
+int numFrees = 0;
+int numLocks = 0;
+
+template <class Function>
+Function findNext(Function& function, const char* name)
+{
+	if (!function)
+		function = (Function)dlsym(RTLD_NEXT, name);
+	return function;
+}
+
+}
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size) noexcept
+{
+	if (inProcess)
+		++numAllocations;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept
+{
+	if (inProcess)
+		++numAllocations;
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* p, size_t size) noexcept
+{
+	if (inProcess)
+		++numAllocations;
+	return __libc_realloc(p, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept
+{
+	if (inProcess)
+		++numAllocations;
+	return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size) noexcept
+{
+	*p = memalign(alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+
+void free(void* p) noexcept
+{
+	if (inProcess && p)
+		++numFrees;
+	__libc_free(p);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+{
+	static int (*next)(pthread_mutex_t*) = nullptr;
+	if (inProcess)
+		++numLocks;
+	return findNext(next, "pthread_mutex_lock")(mutex);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex) noexcept
+{
+	static int (*next)(pthread_mutex_t*) = nullptr;
+	if (inProcess)
+		++numLocks;
+	return findNext(next, "pthread_mutex_trylock")(mutex);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t* lock) noexcept
+{
+	static int (*next)(pthread_rwlock_t*) = nullptr;
+	if (inProcess)
+		++numLocks;
+	return findNext(next, "pthread_rwlock_rdlock")(lock);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t* lock) noexcept
+{
+	static int (*next)(pthread_rwlock_t*) = nullptr;
+	if (inProcess)
+		++numLocks;
+	return findNext(next, "pthread_rwlock_wrlock")(lock);
+}
+
+}
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const int kDefaultNumBlocks = 300;
+const uint32 kDefaultSeed = 1;
+
+class StressInput
+{
+public:
+	explicit StressInput(uint32 seed) : random(seed)
+	{
+		events.reserve(TestEventList::kMaxEvents);
+		for (int32 i = 0; i < ParameterTable::kNumEntries; ++i)
+		{
+			const ParameterDescription& description = ParameterTable::kEntries[i];
+			if ((description.flags & Vst::ParameterInfo::kCanAutomate) && description.id != kAttackId && description.id != kReleaseId)
+				automatable.push_back(description.id);
+		}
+	}
+
+	int32 nextBlockSize() { return uniform(1, TestHost::kMaxBlockSize); }
+
+	// Adds the events and parameter changes of a block of numSamples to the host
+	void fill(TestHost& host, int32 numSamples)
+	{
+		events.clear();
+
+		// Storms of 64 and more note ons on the main bus, over all parts
+		if (uniform(0, 2) == 0)
+		{
+			const int32 numNotes = uniform(MAX_VOICES, 3 * MAX_VOICES);
+			for (int32 i = 0; i < numNotes; ++i)
+			{
+				const Vst::Event e = TestHost::makeNoteOn(uniform(0, numSamples - 1), (int16)uniform(0, 127), (float)uniform(1, 127) / 127.f, (int16)uniform(0, MAX_PARTS - 1));
+				events.push_back(e);
+				held.push_back(e);
+			}
+		}
+
+		// A root change on every sample, through the bass bus
+		if (bassHeld)
+		{
+			for (int16 pitch = kLowestBass; pitch < kLowestBass + 12; ++pitch)
+				events.push_back(TestHost::makeNoteOff(0, pitch, 0, 1));
+			bassHeld = false;
+		}
+		if (uniform(0, 2) == 0)
+		{
+			for (int32 offset = 0; offset < numSamples; ++offset)
+				events.push_back(TestHost::makeNoteOn(offset, (int16)(kLowestBass + uniform(0, 11)), 0.8f, 0, 1));
+			bassHeld = true;
+		}
+
+		// Each held note is released with a chance of a half
+		for (size_t i = 0; i < held.size();)
+		{
+			if (uniform(0, 1) == 0)
+			{
+				events.push_back(TestHost::makeNoteOff(uniform(0, numSamples - 1), held[i].noteOn.pitch, held[i].noteOn.channel));
+				held[i] = held.back();
+				held.pop_back();
+			}
+			else
+				++i;
+		}
+
+		std::stable_sort(events.begin(), events.end(), [](const Vst::Event& a, const Vst::Event& b) { return a.sampleOffset < b.sampleOffset; });
+		for (const Vst::Event& e : events)
+			host.events.add(e);
+
+		// Automation of some parameters, pedals and presets included
+		const int32 numChanges = uniform(0, 6);
+		for (int32 i = 0; i < numChanges; ++i)
+		{
+			const Vst::ParamID id = automatable[uniform(0, (int32)automatable.size() - 1)];
+			int32 offset = 0;
+			for (int32 numPoints = uniform(1, 4); numPoints > 0 && offset < numSamples; --numPoints)
+			{
+				offset = uniform(offset, numSamples - 1);
+				host.parameterChanges.add(id, offset, std::uniform_real_distribution<double>(0.0, 1.0)(random));
+				++offset;
+			}
+		}
+	}
+
+private:
+	static constexpr int16 kLowestBass = 36;
+
+	int32 uniform(int32 from, int32 to) { return std::uniform_int_distribution<int32>(from, to)(random); }
+
+	std::mt19937 random;
+	std::vector<Vst::ParamID> automatable;
+	std::vector<Vst::Event> events;
+	std::vector<Vst::Event> held; // note ons of the main bus without their note off yet
+	bool bassHeld = false;
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+	uint32 seed = kDefaultSeed;
+	if (argc > 1)
+		seed = strcmp(argv[1], "random") == 0 ? std::random_device()() : (uint32)strtoul(argv[1], nullptr, 10);
+	const int numBlocks = argc > 2 ? atoi(argv[2]) : kDefaultNumBlocks;
+	printf("seed %u, %d blocks\n", seed, numBlocks);
+
+	TestHost host(kSampleRate);
+	StressInput input(seed);
+
+	host.parameterChanges.add(kVolumeId, 0, ParameterTable::find(kVolumeId)->toNormalized(0.0));
+	host.parameterChanges.add(kAttackId, 0, ParameterTable::find(kAttackId)->toNormalized(3.0));
+	host.parameterChanges.add(kSustainId, 0, 1.0);
+	host.parameterChanges.add(kReleaseId, 0, ParameterTable::find(kReleaseId)->toNormalized(10000.0));
+	host.parameterChanges.add(kSaveVoicesId, 0, 1.0);
+
+	double worstLoad = 0;
+	int worstBlock = 0;
+	int32 worstBlockSize = 0;
+	int firstFailedBlock = -1;
+	int numBadSamples = 0;
+	int numDenormals = 0;
+
+	for (int block = 0; block < numBlocks; ++block)
+	{
+		const int32 numSamples = input.nextBlockSize();
+		input.fill(host, numSamples);
+
+		const auto start = std::chrono::steady_clock::now();
+		inProcess = true;
+		host.process(numSamples);
+		inProcess = false;
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		const double load = seconds * kSampleRate / numSamples;
+		if (load > worstLoad)
+		{
+			worstLoad = load;
+			worstBlock = block;
+			worstBlockSize = numSamples;
+		}
+
+		for (int32 channel = 0; channel < 2; ++channel)
+		{
+			const float* output = host.getOutput(channel);
+			for (int32 i = 0; i < numSamples; ++i)
+			{
+				if (!std::isfinite(output[i]))
+					++numBadSamples;
+				else if (std::fpclassify(output[i]) == FP_SUBNORMAL)
+					++numDenormals;
+			}
+		}
+
+		if (firstFailedBlock < 0 && (numAllocations || numFrees || numLocks || numBadSamples || numDenormals))
+			firstFailedBlock = block;
+	}
+
+	printf("worst block %.1f %% of its deadline, block %d of %d samples\n", 100.0 * worstLoad, worstBlock, worstBlockSize);
+	printf("allocations %d, frees %d, locks %d, NaN or infinite samples %d, denormal samples %d\n",
+		numAllocations, numFrees, numLocks, numBadSamples, numDenormals);
+
+	if (firstFailedBlock >= 0)
+	{
+		printf("FAILED from block %d, rerun with: stresstest %u %d\n", firstFailedBlock, seed, firstFailedBlock + 1);
+		return 1;
+	}
+	return 0;
+}
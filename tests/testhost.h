@@ -0,0 +1,269 @@
+#pragma once
+
+#include "../include/plugprocessor.h"
+
+#include "pluginterfaces/vst/ivstevents.h"
+#include "pluginterfaces/vst/ivstparameterchanges.h"
+
+#include <utility>
+#include <vector>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// The host side of PlugProcessor::process for the tests and benchmarks. All lists are
+// allocated up front, so the host allocates nothing while the processor runs. They only live
+// on the stack of the test, nothing is reference counted.
+
+class TestEventList : public Vst::IEventList
+{
+public:
+	static constexpr int32 kMaxEvents = 16384; // a note on and off on every sample of the largest block
+
+	TestEventList() { events.reserve(kMaxEvents); }
+
+	void clear() { events.clear(); }
+	bool add(const Vst::Event& e)
+	{
+		if ((int32)events.size() == kMaxEvents)
+			return false;
+		events.push_back(e);
+		return true;
+	}
+
+	int32 PLUGIN_API getEventCount () SMTG_OVERRIDE { return (int32)events.size(); }
+	tresult PLUGIN_API getEvent (int32 index, Vst::Event& e) SMTG_OVERRIDE
+	{
+		if (index < 0 || index >= (int32)events.size())
+			return kInvalidArgument;
+		e = events[index];
+		return kResultOk;
+	}
+	tresult PLUGIN_API addEvent (Vst::Event& e) SMTG_OVERRIDE { return add(e) ? kResultOk : kResultFalse; }
+
+	tresult PLUGIN_API queryInterface (const TUID, void** obj) SMTG_OVERRIDE
+	{
+		*obj = nullptr;
+		return kNoInterface;
+	}
+	uint32 PLUGIN_API addRef () SMTG_OVERRIDE { return 1; }
+	uint32 PLUGIN_API release () SMTG_OVERRIDE { return 1; }
+
+private:
+	std::vector<Vst::Event> events;
+};
+
+class TestParamValueQueue : public Vst::IParamValueQueue
+{
+public:
+	static constexpr int32 kMaxPoints = 256;
+
+	TestParamValueQueue() { points.reserve(kMaxPoints); }
+
+	void reset(Vst::ParamID _id)
+	{
+		id = _id;
+		points.clear();
+	}
+
+	Vst::ParamID PLUGIN_API getParameterId () SMTG_OVERRIDE { return id; }
+	int32 PLUGIN_API getPointCount () SMTG_OVERRIDE { return (int32)points.size(); }
+	tresult PLUGIN_API getPoint (int32 index, int32& sampleOffset, Vst::ParamValue& value) SMTG_OVERRIDE
+	{
+		if (index < 0 || index >= (int32)points.size())
+			return kInvalidArgument;
+		sampleOffset = points[index].first;
+		value = points[index].second;
+		return kResultOk;
+	}
+	tresult PLUGIN_API addPoint (int32 sampleOffset, Vst::ParamValue value, int32& index) SMTG_OVERRIDE
+	{
+		if ((int32)points.size() == kMaxPoints)
+			return kResultFalse;
+		index = (int32)points.size();
+		points.emplace_back(sampleOffset, value);
+		return kResultOk;
+	}
+
+	tresult PLUGIN_API queryInterface (const TUID, void** obj) SMTG_OVERRIDE
+	{
+		*obj = nullptr;
+		return kNoInterface;
+	}
+	uint32 PLUGIN_API addRef () SMTG_OVERRIDE { return 1; }
+	uint32 PLUGIN_API release () SMTG_OVERRIDE { return 1; }
+
+private:
+	Vst::ParamID id = Vst::kNoParamId;
+	std::vector<std::pair<int32, Vst::ParamValue>> points;
+};
+
+class TestParameterChanges : public Vst::IParameterChanges
+{
+public:
+	static constexpr int32 kMaxQueues = 128;
+
+	TestParameterChanges() : queues(kMaxQueues) {}
+
+	void clear() { numQueues = 0; }
+
+	// Points must be added in the order of their offsets, like a host does
+	bool add(Vst::ParamID id, int32 sampleOffset, Vst::ParamValue value)
+	{
+		int32 index;
+		Vst::IParamValueQueue* queue = addParameterData(id, index);
+		return queue && queue->addPoint(sampleOffset, value, index) == kResultOk;
+	}
+
+	// nullptr if the processor didn't send the parameter
+	TestParamValueQueue* find(Vst::ParamID id)
+	{
+		for (int32 i = 0; i < numQueues; ++i)
+		{
+			if (queues[i].getParameterId() == id)
+				return &queues[i];
+		}
+		return nullptr;
+	}
+
+	int32 PLUGIN_API getParameterCount () SMTG_OVERRIDE { return numQueues; }
+	Vst::IParamValueQueue* PLUGIN_API getParameterData (int32 index) SMTG_OVERRIDE
+	{
+		return index >= 0 && index < numQueues ? &queues[index] : nullptr;
+	}
+	Vst::IParamValueQueue* PLUGIN_API addParameterData (const Vst::ParamID& id, int32& index) SMTG_OVERRIDE
+	{
+		for (index = 0; index < numQueues; ++index)
+		{
+			if (queues[index].getParameterId() == id)
+				return &queues[index];
+		}
+		if (numQueues == kMaxQueues)
+			return nullptr;
+		queues[numQueues].reset(id);
+		return &queues[numQueues++];
+	}
+
+	tresult PLUGIN_API queryInterface (const TUID, void** obj) SMTG_OVERRIDE
+	{
+		*obj = nullptr;
+		return kNoInterface;
+	}
+	uint32 PLUGIN_API addRef () SMTG_OVERRIDE { return 1; }
+	uint32 PLUGIN_API release () SMTG_OVERRIDE { return 1; }
+
+private:
+	std::vector<TestParamValueQueue> queues;
+	int32 numQueues = 0;
+};
+
+// A PlugProcessor set up, active and processing into the main output, like in a host
+class TestHost
+{
+public:
+	static constexpr int32 kMaxBlockSize = 8192;
+
+	TestHost(double sampleRate = 48000.0, int32 _processMode = Vst::kRealtime)
+	: processor(owned(new PlugProcessor()))
+	, processMode(_processMode)
+	{
+		processor->initialize(nullptr);
+		Vst::ProcessSetup setup = { processMode, Vst::kSample32, kMaxBlockSize, sampleRate };
+		processor->setupProcessing(setup);
+		for (auto& channel : output)
+			channel.assign(kMaxBlockSize, 0.f);
+		start();
+	}
+
+	~TestHost()
+	{
+		stop();
+		processor->terminate();
+	}
+
+	void start()
+	{
+		processor->setActive(true);
+		processor->setProcessing(true);
+	}
+
+	void stop()
+	{
+		processor->setProcessing(false);
+		processor->setActive(false);
+	}
+
+	PlugProcessor& getProcessor() { return *processor; }
+
+	// Renders numSamples with the events and parameter changes added since the last call
+	tresult process(int32 numSamples)
+	{
+		float* channels[2] = { output[0].data(), output[1].data() };
+		Vst::AudioBusBuffers bus;
+		bus.numChannels = 2;
+		bus.silenceFlags = 0;
+		bus.channelBuffers32 = channels;
+
+		Vst::ProcessData data;
+		data.processMode = processMode;
+		data.symbolicSampleSize = Vst::kSample32;
+		data.numSamples = numSamples;
+		data.numInputs = 0;
+		data.inputs = nullptr;
+		data.numOutputs = 1;
+		data.outputs = &bus;
+		data.inputParameterChanges = &parameterChanges;
+		data.outputParameterChanges = &outputParameterChanges;
+		data.inputEvents = &events;
+		data.outputEvents = nullptr;
+		data.processContext = nullptr;
+
+		outputParameterChanges.clear();
+		const tresult result = processor->process(data);
+		events.clear();
+		parameterChanges.clear();
+		return result;
+	}
+
+	// Of the last process call
+	const float* getOutput(int32 channel) const { return output[channel].data(); }
+
+	TestEventList events;
+	TestParameterChanges parameterChanges;
+	TestParameterChanges outputParameterChanges;
+
+	static Vst::Event makeNoteOn(int32 sampleOffset, int16 pitch, float velocity = 0.8f, int16 channel = 0, int32 busIndex = 0)
+	{
+		Vst::Event e = {};
+		e.busIndex = busIndex;
+		e.sampleOffset = sampleOffset;
+		e.type = Vst::Event::kNoteOnEvent;
+		e.noteOn.channel = channel;
+		e.noteOn.pitch = pitch;
+		e.noteOn.velocity = velocity;
+		e.noteOn.noteId = -1;
+		return e;
+	}
+
+	static Vst::Event makeNoteOff(int32 sampleOffset, int16 pitch, int16 channel = 0, int32 busIndex = 0)
+	{
+		Vst::Event e = {};
+		e.busIndex = busIndex;
+		e.sampleOffset = sampleOffset;
+		e.type = Vst::Event::kNoteOffEvent;
+		e.noteOff.channel = channel;
+		e.noteOff.pitch = pitch;
+		e.noteOff.noteId = -1;
+		return e;
+	}
+
+private:
+	IPtr<PlugProcessor> processor;
+	int32 processMode;
+	std::vector<float> output[2];
+};
+
+}
+}
@@ -0,0 +1,282 @@
+
+#include "../tests/testhost.h"
+#include "../include/parameters.h"
+#include "../include/plugids.h"
+#include "../include/statechunks.h"
+
+#include "public.sdk/source/common/memorystream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+using namespace Benergy::BadTempered;
+
+// Saves the voices in the middle of a render and reloads them into another processor.
+// The tails rendered after the reload have to match the original render, with the LFOs
+// running through the saved modulation state. Notes still held when saving have to be
+// released by the reload.
+//
+// Also loads a state in the format before the chunks, whose tuning list was shorter, a state
+// with a chunk this version doesn't know, and a state while processing.
+
+namespace {
+
+const double kSampleRate = 48000.0;
+const int32 kBlockSize = 256;
+const int32 kSaveBlock = 40; // getState is called before this block
+const int32 kMaxSnapshotAge = 19; // blocks, the interval the processor publishes the voices at
+const int32 kNumCompared = 200;
+const double kReleaseSeconds = 1.0;
+
+using Render = std::vector<float>; // channels one after the other per block
+
+void setUp(TestHost& host)
+{
+	host.parameterChanges.add(kSaveVoicesId, 0, 1.0);
+	host.parameterChanges.add(kVolumeId, 0, ParameterTable::find(kVolumeId)->toNormalized(0.0));
+	host.parameterChanges.add(kAttackId, 0, ParameterTable::find(kAttackId)->toNormalized(20.0));
+	host.parameterChanges.add(kSustainId, 0, 0.7);
+	host.parameterChanges.add(kReleaseId, 0, ParameterTable::find(kReleaseId)->toNormalized(1000.0 * kReleaseSeconds));
+	host.parameterChanges.add(kLfo1RateId, 0, ParameterTable::find(kLfo1RateId)->toNormalized(5.0));
+	host.parameterChanges.add(kMod1SourceId, 0, ParameterTable::find(kMod1SourceId)->toNormalized(kModSourceLfo1));
+	host.parameterChanges.add(kMod1DestinationId, 0, ParameterTable::find(kMod1DestinationId)->toNormalized(kModDestinationPitch));
+	host.parameterChanges.add(kMod1AmountId, 0, ParameterTable::find(kMod1AmountId)->toNormalized(5.0));
+	host.parameterChanges.add(kMod2SourceId, 0, ParameterTable::find(kMod2SourceId)->toNormalized(kModSourceLfo2));
+	host.parameterChanges.add(kMod2DestinationId, 0, ParameterTable::find(kMod2DestinationId)->toNormalized(kModDestinationVolume));
+	host.parameterChanges.add(kMod2AmountId, 0, ParameterTable::find(kMod2AmountId)->toNormalized(-50.0));
+	for (int16 pitch : {48, 55, 60, 64, 67, 71})
+		host.events.add(TestHost::makeNoteOn(0, pitch));
+}
+
+void processBlock(TestHost& host, Render& render)
+{
+	host.process(kBlockSize);
+	for (int32 channel = 0; channel < 2; ++channel)
+		render.insert(render.end(), host.getOutput(channel), host.getOutput(channel) + kBlockSize);
+}
+
+// Renders kSaveBlock blocks, calls getState, which doesn't wait for the audio thread, and
+// renders kNumCompared blocks after that
+void renderAndSave(bool releaseNotes, MemoryStream& state, Render& render)
+{
+	TestHost host(kSampleRate, Vst::kOffline);
+	setUp(host);
+
+	for (int32 block = 0; block < kSaveBlock + kNumCompared; ++block)
+	{
+		if (block == kSaveBlock / 2 && releaseNotes)
+		{
+			for (int16 pitch : {48, 55, 60, 64, 67, 71})
+				host.events.add(TestHost::makeNoteOff(0, pitch));
+		}
+		if (block == kSaveBlock)
+			host.getProcessor().getState(&state);
+		processBlock(host, render);
+	}
+}
+
+Render renderRestored(MemoryStream& state, int32 numBlocks)
+{
+	TestHost host(kSampleRate, Vst::kOffline);
+	state.seek(0, IBStream::kIBSeekSet, nullptr);
+	host.getProcessor().setState(&state);
+
+	Render render;
+	for (int32 block = 0; block < numBlocks; ++block)
+		processBlock(host, render);
+	return render;
+}
+
+std::vector<char> saveState(TestHost& host)
+{
+	MemoryStream stream;
+	host.getProcessor().getState(&stream);
+	return std::vector<char>(stream.getData(), stream.getData() + stream.getSize());
+}
+
+tresult loadState(TestHost& host, std::vector<char> state)
+{
+	MemoryStream stream(state.data(), (TSize)state.size());
+	return host.getProcessor().setState(&stream);
+}
+
+// The values of the parameters chunk, list parameters as their index
+std::map<uint32, double> readSavedValues(const std::vector<char>& state)
+{
+	std::map<uint32, double> values;
+	StateReader s(reinterpret_cast<const uint8*>(state.data()), state.size());
+	uint32 magic, version, tag, size;
+	if (!s.read(magic) || !s.read(version))
+		return values;
+	StateReader chunk;
+	while (s.read(tag) && s.read(size) && s.sub(size, chunk))
+	{
+		uint32 id;
+		double value;
+		while (tag == makeChunkTag('P', 'A', 'R', 'M') && chunk.read(id) && chunk.read(value))
+			values[id] = value;
+	}
+	return values;
+}
+
+template <class T>
+void append(std::vector<char>& state, const T& value)
+{
+	const char* bytes = reinterpret_cast<const char*>(&value);
+	state.insert(state.end(), bytes, bytes + sizeof(T));
+}
+
+double getMaxDifference(const float* a, const float* b, size_t numSamples)
+{
+	double maxDiff = 0;
+	for (size_t i = 0; i < numSamples; ++i)
+		maxDiff = std::max(maxDiff, (double)std::fabs(a[i] - b[i]));
+	return maxDiff;
+}
+
+double getPeak(const float* samples, size_t numSamples)
+{
+	return getMaxDifference(samples, std::vector<float>(numSamples, 0.f).data(), numSamples);
+}
+
+}
+
+int main()
+{
+	bool passed = true;
+	const size_t blockValues = 2 * kBlockSize;
+
+	// Release tails. The voices saved are the ones published last before kSaveBlock, at most
+	// kMaxSnapshotAge blocks before, and the restored render continues from there.
+	{
+		MemoryStream state;
+		Render original;
+		renderAndSave(true, state, original);
+		const Render restored = renderRestored(state, kNumCompared);
+
+		int32 snapshotBlock = -1;
+		for (int32 block = kSaveBlock; block >= kSaveBlock - kMaxSnapshotAge && snapshotBlock < 0; --block)
+		{
+			if (getMaxDifference(&original[block * blockValues], restored.data(), blockValues) == 0.0)
+				snapshotBlock = block;
+		}
+
+		if (snapshotBlock < 0)
+		{
+			printf("tails: no block matches the restored render FAILED\n");
+			passed = false;
+		}
+		else
+		{
+			const double maxDiff = getMaxDifference(&original[snapshotBlock * blockValues], restored.data(), restored.size());
+			const double peak = getPeak(restored.data(), restored.size());
+			const bool matches = maxDiff == 0.0 && peak > 0.01;
+			printf("tails: saved before block %d, peak %g, max difference %g %s\n", snapshotBlock, peak, maxDiff, matches ? "ok" : "FAILED");
+			passed &= matches;
+		}
+	}
+
+	// Held notes, they have to end within the release time
+	{
+		MemoryStream state;
+		Render original;
+		renderAndSave(false, state, original);
+		const int32 numBlocks = (int32)(2.0 * kReleaseSeconds * kSampleRate / kBlockSize);
+		const Render restored = renderRestored(state, numBlocks);
+
+		const double startPeak = getPeak(restored.data(), blockValues);
+		const double endPeak = getPeak(&restored[restored.size() - blockValues], blockValues);
+		const double heldPeak = getPeak(&original[original.size() - blockValues], blockValues);
+		const bool released = startPeak > 0.01 && endPeak == 0.0 && heldPeak > 0.01;
+		printf("held notes: peak %g after the reload, %g after %g s, %g without the reload %s\n",
+			startPeak, endPeak, 2.0 * kReleaseSeconds, heldPeak, released ? "ok" : "FAILED");
+		passed &= released;
+	}
+
+	// Version 0: a uint64 version, the first twelve values as doubles and the bypass as int16
+	// after the root note. The tuning list had four entries, 0.4 was Pythagorean.
+	{
+		std::vector<char> legacy;
+		append(legacy, uint64(0));
+		for (double value : {0.75, 0.4, 0.25})
+			append(legacy, value);
+		append(legacy, int16(1));
+		for (double value : {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8})
+			append(legacy, value);
+
+		TestHost host(kSampleRate, Vst::kOffline);
+		const tresult result = loadState(host, legacy);
+		host.process(kBlockSize);
+		std::map<uint32, double> values = readSavedValues(saveState(host));
+
+		const std::pair<uint32, double> expected[] = {
+			{ kVolumeId, 0.75 }, { kTuningId, kPythagoreanTuning }, { kRootNoteId, 0.25 }, { kBypassId, 1.0 },
+			{ kAttackId, 0.1 }, { kDecayId, 0.2 }, { kSustainId, 0.3 }, { kReleaseId, 0.4 },
+			{ kSinusVolumeId, 0.5 }, { kSquareVolumeId, 0.6 }, { kSawVolumeId, 0.7 }, { kTriVolumeId, 0.8 },
+			{ kFilterCutoffId, ParameterTable::find(kFilterCutoffId)->defaultNormalized }, // newer ones get their defaults
+			{ kUnisonVoicesId, ParameterTable::find(kUnisonVoicesId)->defaultNormalized },
+		};
+		int32 numWrong = 0;
+		for (const auto& value : expected)
+		{
+			if (values.count(value.first) == 0 || values[value.first] != value.second)
+			{
+				printf("legacy state: parameter %u is %g instead of %g\n", value.first, values[value.first], value.second);
+				++numWrong;
+			}
+		}
+		const bool loaded = result == kResultTrue && numWrong == 0;
+		printf("legacy state: %d of %d values wrong %s\n", numWrong, (int32)(sizeof(expected) / sizeof(expected[0])), loaded ? "ok" : "FAILED");
+		passed &= loaded;
+	}
+
+	// An unknown chunk before the parameters, from a newer version, is skipped
+	{
+		TestHost original(kSampleRate, Vst::kOffline);
+		original.parameterChanges.add(kVolumeId, 0, 0.3);
+		original.parameterChanges.add(kTuningId, 0, ParameterTable::find(kTuningId)->toNormalized(kMeantoneTuning));
+		original.parameterChanges.add(kFilterCutoffId, 0, 0.4);
+		original.process(kBlockSize);
+		const std::vector<char> state = saveState(original);
+
+		std::vector<char> unknown;
+		append(unknown, makeChunkTag('Z', 'Z', 'Z', 'Z'));
+		append(unknown, uint32(5));
+		unknown.insert(unknown.end(), { 1, 2, 3, 4, 5 });
+		std::vector<char> withUnknown = state;
+		withUnknown.insert(withUnknown.begin() + 2 * sizeof(uint32), unknown.begin(), unknown.end());
+
+		TestHost host(kSampleRate, Vst::kOffline);
+		const tresult result = loadState(host, withUnknown);
+		host.process(kBlockSize);
+		const bool loaded = result == kResultTrue && saveState(host) == state;
+		printf("unknown chunk: %s\n", loaded ? "ok" : "FAILED");
+		passed &= loaded;
+	}
+
+	// Loaded while active, the audio thread takes it with its next block. Saved before that,
+	// the loaded state is saved.
+	{
+		TestHost original(kSampleRate, Vst::kOffline);
+		original.parameterChanges.add(kVolumeId, 0, 0.3);
+		original.parameterChanges.add(kUnisonVoicesId, 0, 0.5);
+		original.process(kBlockSize);
+		const std::vector<char> state = saveState(original);
+
+		TestHost host(kSampleRate, Vst::kOffline);
+		host.process(kBlockSize);
+		const tresult result = loadState(host, state);
+		const bool savedBefore = saveState(host) == state;
+		host.process(kBlockSize);
+		const bool savedAfter = saveState(host) == state;
+		const bool loaded = result == kResultTrue && savedBefore && savedAfter;
+		printf("loaded while active: saved %s before the next block, %s after it %s\n",
+			savedBefore ? "as loaded" : "differently", savedAfter ? "as loaded" : "differently", loaded ? "ok" : "FAILED");
+		passed &= loaded;
+	}
+
+	return passed ? 0 : 1;
+}
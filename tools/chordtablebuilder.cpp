@@ -0,0 +1,102 @@
+#include "pluginterfaces/base/ftypes.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace Steinberg;
+
+// Writes the best roots for every set of pitch classes, the table the root note follower looks
+// chords up in, as the initializer of a uint16 array. Run by the build, so the table is read-only
+// data of the plug-in instead of being computed by a static initialiser when it is loaded.
+//
+//   chordtablebuilder <output>
+
+namespace {
+
+int32 countBits(uint32 bits)
+{
+	int32 count = 0;
+	for (; bits; bits &= bits - 1)
+		++count;
+	return count;
+}
+
+uint32 rotatePitchClasses(uint32 classes, int32 steps)
+{
+	return ((classes << steps) | (classes >> (12 - steps))) & 0xFFF;
+}
+
+// Intervals above the root as bits, the root is bit 0. A missing fifth costs like any other
+// missing note.
+const uint32 kTemplates[] = {
+	0x091, // major
+	0x089, // minor
+	0x049, // diminished
+	0x111, // augmented
+	0x0A1, // sus4
+	0x085, // sus2
+	0x491, // dominant 7th
+	0x891, // major 7th
+	0x489, // minor 7th
+	0x449, // half diminished
+	0x249, // diminished 7th
+	0x291, // major 6th
+	0x289, // minor 6th
+	0x081, // fifth
+};
+
+// Each chord template is tried on every held pitch class, held notes of the template count
+// for it, missing and extra ones against it. Bit per root, all equally good ones are set.
+uint16 findRoots(uint32 classes)
+{
+	int32 bestScore = -1000;
+	uint16 best = 0;
+	for (int32 root = 0; root < 12; ++root)
+	{
+		if (!(classes & (1 << root)))
+			continue;
+
+		int32 score = 3 - 2 * (countBits(classes) - 1); // a single note, the others extra
+		for (uint32 chord : kTemplates)
+		{
+			const uint32 rotated = rotatePitchClasses(chord, root);
+			score = std::max(score, 3 * countBits(rotated & classes) - 2 * countBits(rotated & ~classes) - 2 * countBits(classes & ~rotated));
+		}
+
+		if (score > bestScore)
+		{
+			bestScore = score;
+			best = 0;
+		}
+		if (score == bestScore)
+			best |= 1 << root;
+	}
+	return best;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		printf("usage: chordtablebuilder <output>\n");
+		return 1;
+	}
+
+	FILE* file = fopen(argv[1], "w");
+	if (!file)
+	{
+		printf("%s: can't be written\n", argv[1]);
+		return 1;
+	}
+
+	fprintf(file, "// Generated by tools/chordtablebuilder.cpp, bit per root for each set of pitch classes\n");
+	for (uint32 classes = 0; classes < 4096; classes += 8)
+	{
+		fprintf(file, "\t");
+		for (uint32 c = classes; c < classes + 8; ++c)
+			fprintf(file, "0x%03X,%s", findRoots(c), c + 1 < classes + 8 ? " " : "\n");
+	}
+	return fclose(file) == 0 ? 0 : 1;
+}
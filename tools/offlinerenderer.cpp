@@ -0,0 +1,266 @@
+
+#include "offlinerenderer.h"
+#include "../include/plugprocessor.h"
+#include "../include/rootfollower.h"
+
+#include "public.sdk/source/common/memorystream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace Benergy {
+namespace BadTempered {
+
+// The events of one block, offsets relative to the block
+class BlockEventList : public Vst::IEventList
+{
+public:
+	explicit BlockEventList(int32 maxEvents) { events.reserve(maxEvents); }
+
+	void clear() { events.clear(); }
+	void add(const Vst::Event& e) { events.push_back(e); }
+
+	int32 PLUGIN_API getEventCount () SMTG_OVERRIDE { return (int32)events.size(); }
+	tresult PLUGIN_API getEvent (int32 index, Vst::Event& e) SMTG_OVERRIDE
+	{
+		if (index < 0 || index >= (int32)events.size())
+			return kInvalidArgument;
+		e = events[index];
+		return kResultOk;
+	}
+	tresult PLUGIN_API addEvent (Vst::Event&) SMTG_OVERRIDE { return kResultFalse; }
+
+	// Only lives on the stack of a worker
+	tresult PLUGIN_API queryInterface (const TUID, void** obj) SMTG_OVERRIDE
+	{
+		*obj = nullptr;
+		return kNoInterface;
+	}
+	uint32 PLUGIN_API addRef () SMTG_OVERRIDE { return 1; }
+	uint32 PLUGIN_API release () SMTG_OVERRIDE { return 1; }
+
+private:
+	std::vector<Vst::Event> events;
+};
+
+// Set up like a host would, with the state loaded, but not active yet
+static IPtr<PlugProcessor> createProcessor(const std::vector<char>& state, double sampleRate, int32 blockSize)
+{
+	IPtr<PlugProcessor> processor = owned(new PlugProcessor());
+	if (processor->initialize(nullptr) != kResultTrue)
+		return nullptr;
+
+	Vst::ProcessSetup setup = { Vst::kOffline, Vst::kSample32, blockSize, sampleRate };
+	processor->setupProcessing(setup);
+
+	MemoryStream stream(const_cast<char*>(state.data()), (TSize)state.size()); // only read
+	if (processor->setState(&stream) != kResultTrue)
+	{
+		processor->terminate();
+		return nullptr;
+	}
+	return processor;
+}
+
+//------------------------------------------------------------------------
+OfflineRenderer::OfflineRenderer(const void* _state, int32 stateSize, double _sampleRate, int32 _blockSize)
+: state(static_cast<const char*>(_state), static_cast<const char*>(_state) + std::max(stateSize, int32(0)))
+, sampleRate(_sampleRate)
+, blockSize(std::max(_blockSize, int32(1)))
+{
+}
+
+//------------------------------------------------------------------------
+bool OfflineRenderer::findSegments(const TimelineEvent* events, int32 numEvents, int64 numSamples)
+{
+	// The state decides how long the tails are and where the root note comes from
+	IPtr<PlugProcessor> probe = createProcessor(state, sampleRate, blockSize);
+	if (!probe)
+		return false;
+	const int64 tail = probe->getTailSamples();
+	const bool followChords = probe->followsChords();
+	probe->terminate();
+
+	const int64 minLength = (int64)(kMinSegmentLength * sampleRate);
+	segments.assign(1, Segment { 0, numSamples, 0, -1 });
+	maxBlockEvents = 0;
+
+	NoteSet held[2][16]; // by bus and channel
+	int32 numHeld = 0;
+	// Voices saved with the state are released when it is loaded, so they end within the tail too
+	int64 silentFrom = 0;
+	RootNoteFollower follower;
+	follower.reset();
+	int32 rootNote = -1;
+	int64 block = -1;
+	int32 blockFirstEvent = 0;
+
+	for (int32 i = 0; i < numEvents; ++i)
+	{
+		const TimelineEvent& t = events[i];
+		if (t.position < 0 || (i > 0 && t.position < events[i - 1].position))
+			return false;
+		if (t.position >= numSamples)
+			break;
+
+		const int64 eventBlock = t.position / blockSize;
+		if (eventBlock != block)
+		{
+			// The processor takes the chord root once per block, after the block's events
+			if (followChords && block >= 0)
+			{
+				const int32 root = follower.findRoot();
+				if (root >= 0)
+					rootNote = root;
+			}
+			block = eventBlock;
+			blockFirstEvent = i;
+		}
+		maxBlockEvents = std::max(maxBlockEvents, i - blockFirstEvent + 1);
+
+		const Vst::Event& e = t.event;
+		const bool noteOn = e.type == Vst::Event::kNoteOnEvent && e.noteOn.velocity > 0.f;
+		const bool noteOff = (e.type == Vst::Event::kNoteOnEvent && !noteOn) || e.type == Vst::Event::kNoteOffEvent;
+
+		// A note off in the same block is less than the tail back, so the block holds no
+		// other notes here
+		if (noteOn && numHeld == 0)
+		{
+			const int64 split = eventBlock * blockSize;
+			if (split >= silentFrom + tail && split - segments.back().start >= minLength)
+			{
+				segments.back().end = split;
+				segments.push_back(Segment { split, numSamples, blockFirstEvent, rootNote });
+			}
+		}
+
+		if (noteOn || noteOff)
+		{
+			const int32 pitch = e.type == Vst::Event::kNoteOnEvent ? e.noteOn.pitch : e.noteOff.pitch;
+			const int32 channel = (e.type == Vst::Event::kNoteOnEvent ? e.noteOn.channel : e.noteOff.channel) & 15;
+			NoteSet& notes = held[e.busIndex == 1 ? 1 : 0][channel];
+			if (pitch >= 0 && pitch <= 127)
+			{
+				if (noteOn && !notes.contains(pitch))
+				{
+					notes.add(pitch);
+					++numHeld;
+				}
+				else if (noteOff && notes.contains(pitch))
+				{
+					notes.remove(pitch);
+					if (--numHeld == 0)
+						silentFrom = t.position;
+				}
+			}
+		}
+
+		if (!followChords && noteOn && e.busIndex == 1)
+			rootNote = e.noteOn.pitch;
+		follower.processEvent(e);
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+bool OfflineRenderer::renderSegment(const Segment& segment, const TimelineEvent* events, int32 numEvents, float* left, float* right) const
+{
+	IPtr<PlugProcessor> processor = createProcessor(state, sampleRate, blockSize);
+	if (!processor)
+		return false;
+
+	// Later segments start in silence, with the root note the timeline had there
+	if (segment.start > 0)
+	{
+		processor->discardRestoredVoices();
+		if (segment.rootNote >= 0)
+			processor->setRootNote(segment.rootNote);
+	}
+
+	if (processor->setActive(true) != kResultTrue)
+	{
+		processor->terminate();
+		return false;
+	}
+	processor->setProcessing(true);
+
+	BlockEventList eventList(maxBlockEvents);
+	float* channels[2];
+	Vst::AudioBusBuffers output;
+	output.numChannels = 2;
+	output.silenceFlags = 0;
+	output.channelBuffers32 = channels;
+
+	Vst::ProcessData data;
+	data.processMode = Vst::kOffline;
+	data.symbolicSampleSize = Vst::kSample32;
+	data.numInputs = 0;
+	data.inputs = nullptr;
+	data.numOutputs = 1;
+	data.outputs = &output;
+	data.inputParameterChanges = nullptr;
+	data.outputParameterChanges = nullptr;
+	data.inputEvents = &eventList;
+	data.outputEvents = nullptr;
+	data.processContext = nullptr;
+
+	int32 eventIndex = segment.firstEvent;
+	for (int64 position = segment.start; position < segment.end; position += blockSize)
+	{
+		data.numSamples = (int32)std::min((int64)blockSize, segment.end - position);
+
+		eventList.clear();
+		for (; eventIndex < numEvents && events[eventIndex].position < position + data.numSamples; ++eventIndex)
+		{
+			Vst::Event e = events[eventIndex].event;
+			e.sampleOffset = (int32)(events[eventIndex].position - position);
+			eventList.add(e);
+		}
+
+		channels[0] = left + position;
+		channels[1] = right + position;
+		processor->process(data);
+	}
+
+	processor->setProcessing(false);
+	processor->setActive(false);
+	processor->terminate();
+	return true;
+}
+
+//------------------------------------------------------------------------
+tresult OfflineRenderer::render(const TimelineEvent* events, int32 numEvents, float* left, float* right, int64 numSamples, int32 numThreads)
+{
+	if (!left || !right || numSamples < 0 || (numEvents > 0 && !events))
+		return kInvalidArgument;
+	if (!findSegments(events, numEvents, numSamples))
+		return kResultFalse;
+
+	if (numThreads < 1)
+		numThreads = (int32)std::thread::hardware_concurrency();
+	numThreads = std::min(std::max(numThreads, int32(1)), getNumSegments());
+
+	// Segments are taken in order, each writes its own range of the output
+	std::atomic<int32> nextSegment {0};
+	std::atomic<bool> failed {false};
+	auto work = [&]() {
+		for (int32 s = nextSegment++; s < getNumSegments(); s = nextSegment++)
+		{
+			if (!renderSegment(segments[s], events, numEvents, left, right))
+				failed = true;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int32 t = 1; t < numThreads; ++t)
+		workers.emplace_back(work);
+	work();
+	for (auto& worker : workers)
+		worker.join();
+
+	return failed ? kResultFalse : kResultOk;
+}
+
+}
+}
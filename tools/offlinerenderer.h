@@ -0,0 +1,61 @@
+#pragma once
+
+#include "pluginterfaces/vst/ivstevents.h"
+
+#include <vector>
+
+namespace Benergy {
+namespace BadTempered {
+
+using namespace Steinberg;
+
+// Renders a MIDI timeline without a host, for batch exports. The timeline is split into
+// segments at silence points, where no note is held and every tail has ended, and the
+// segments are rendered in parallel, each on its own PlugProcessor starting from the same
+// state. The segments are block aligned and start with the root note the timeline had
+// there, so their outputs put next to each other are the output of a single rendering.
+// Only the free running LFOs start over in each segment, like they do when a host starts
+// playback there.
+class OfflineRenderer
+{
+public:
+	struct TimelineEvent
+	{
+		int64 position; // in samples from the start, the event's sampleOffset is ignored
+		Vst::Event event; // busIndex 1 is the bass bus
+	};
+
+	// state as written by PlugProcessor::getState. Voices saved with it play in the first
+	// segment only, released like after any reload.
+	OfflineRenderer(const void* state, int32 stateSize, double sampleRate, int32 blockSize = 512);
+
+	// Renders numSamples of the main output to left and right. The events must be sorted by
+	// position. numThreads 0 uses all cores.
+	tresult render(const TimelineEvent* events, int32 numEvents, float* left, float* right, int64 numSamples, int32 numThreads = 0);
+
+	// Of the last render
+	int32 getNumSegments() const { return (int32)segments.size(); }
+
+	static constexpr double kMinSegmentLength = 2.0; // in s, shorter ones are not split off
+
+private:
+	struct Segment
+	{
+		int64 start;
+		int64 end;
+		int32 firstEvent;
+		int32 rootNote; // when the segment starts, -1 keeps the one of the state
+	};
+
+	bool findSegments(const TimelineEvent* events, int32 numEvents, int64 numSamples);
+	bool renderSegment(const Segment& segment, const TimelineEvent* events, int32 numEvents, float* left, float* right) const;
+
+	std::vector<char> state;
+	double sampleRate;
+	int32 blockSize;
+	int32 maxBlockEvents = 0;
+	std::vector<Segment> segments;
+};
+
+}
+}
@@ -0,0 +1,127 @@
+#include "../include/presetbank.h"
+
+#include "public.sdk/source/common/memorystream.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace Benergy::BadTempered;
+
+// Builds a preset bank from presets saved by a host, as .vstpreset files, or from states as
+// written by PlugProcessor::getState. The presets are named after their files, the multitimbral
+// parts of a state are left out.
+//
+//   presetbankbuilder <bank> <preset>...
+
+namespace {
+
+bool readFile(const char* path, std::vector<char>& contents)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	char buffer[4096];
+	size_t numBytesRead;
+	while ((numBytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		contents.insert(contents.end(), buffer, buffer + numBytesRead);
+	return fclose(file) == 0;
+}
+
+template <class T>
+bool readAt(const std::vector<char>& contents, uint64 offset, T& value)
+{
+	if (offset > contents.size() || sizeof(T) > contents.size() - offset)
+		return false;
+	memcpy(&value, &contents[offset], sizeof(T));
+	return true;
+}
+
+// The component state in a .vstpreset: 'VST3', int32 version, 32 characters of class id and
+// the int64 offset of the chunk list, which is 'List', int32 count and per chunk 4 characters
+// of id, int64 offset and int64 size
+bool findComponentState(const std::vector<char>& contents, uint64& offset, uint64& size)
+{
+	const uint64 kListOffsetPos = 4 + 4 + 32;
+	int64 listOffset = 0;
+	int32 numChunks = 0;
+	if (!readAt(contents, kListOffsetPos, listOffset) || listOffset < 0
+		|| (uint64)listOffset > contents.size() - 4 || memcmp(&contents[listOffset], "List", 4) != 0
+		|| !readAt(contents, listOffset + 4, numChunks))
+		return false;
+
+	for (int32 c = 0; c < numChunks; ++c)
+	{
+		const uint64 entry = listOffset + 8 + (uint64)c * 20;
+		int64 chunkOffset, chunkSize;
+		if (!readAt(contents, entry + 4, chunkOffset) || !readAt(contents, entry + 12, chunkSize))
+			return false;
+		if (memcmp(&contents[entry], "Comp", 4) == 0 && chunkOffset >= 0 && chunkSize >= 0
+			&& (uint64)chunkOffset <= contents.size() && (uint64)chunkSize <= contents.size() - chunkOffset)
+		{
+			offset = chunkOffset;
+			size = chunkSize;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string getPresetName(const std::string& path)
+{
+	const size_t start = path.find_last_of("/\\") == std::string::npos ? 0 : path.find_last_of("/\\") + 1;
+	const size_t end = path.find_last_of('.');
+	return path.substr(start, end == std::string::npos || end < start ? std::string::npos : end - start);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		printf("usage: presetbankbuilder <bank> <preset>...\n");
+		return 1;
+	}
+
+	std::vector<PresetBank::Preset> presets;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::vector<char> contents;
+		if (!readFile(argv[i], contents))
+		{
+			printf("%s: can't be read\n", argv[i]);
+			return 1;
+		}
+
+		uint64 offset = 0;
+		uint64 size = contents.size();
+		if (contents.size() >= 4 && memcmp(contents.data(), "VST3", 4) == 0 && !findComponentState(contents, offset, size))
+		{
+			printf("%s: no component state in the preset\n", argv[i]);
+			return 1;
+		}
+
+		ParameterValues state;
+		MemoryStream stream(contents.data() + offset, (TSize)size);
+		if (state.setState(&stream) != kResultTrue)
+		{
+			printf("%s: not a state of this plug-in\n", argv[i]);
+			return 1;
+		}
+
+		const std::string name = getPresetName(argv[i]);
+		if (name.size() >= sizeof(PresetRecord::name))
+			printf("%s: the name is cut to %d bytes\n", argv[i], (int)sizeof(PresetRecord::name) - 1);
+		presets.push_back({ name, state });
+	}
+
+	if (!PresetBank::write(argv[1], presets))
+	{
+		printf("%s: can't be written\n", argv[1]);
+		return 1;
+	}
+	printf("%s: %d presets\n", argv[1], (int)presets.size());
+	return 0;
+}